@@ -0,0 +1,237 @@
+#ifndef _BINIO_H_
+#define _BINIO_H_
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <stdio.h>
+
+/* Binary, columnar dataset format as written by grt-convert. Everything is
+ * stored in host byte order, all sections start on 8-byte boundaries:
+ *
+ *  header        see below
+ *  label table   nlabels times (uint32 length, bytes), label 0 is NULL
+ *  labels        uint32 label index per sample
+ *  segments      samples+1 uint64 row offsets (timeseries only)
+ *  data          dims columns, each holding rows float32 or float64 values
+ *
+ * A classification dataset has one row per sample, so as many rows as
+ * samples, a timeseries one holds samples segments made of consecutive
+ * rows. The magic starts with a byte that is not valid text, so the format
+ * can be told apart from the first byte of the input. */
+#define GRT_BINARY_MAGIC   "\x89GRT\r\n\x1a\n"
+#define GRT_BINARY_VERSION 1
+#define GRT_BINARY_ORDER   0x01020304
+
+enum { GRT_BINARY_TIMESERIES = 0, GRT_BINARY_CLASSIFICATION = 1 };
+
+struct grt_binary_header {
+  char     magic[8];
+  uint32_t version, byteorder;
+  uint32_t type, dtype;          // dtype is the size of a value: 4 or 8
+  uint32_t dims, reserved;
+  uint64_t samples, rows, nlabels;
+  uint64_t labels_offset, sample_labels_offset, segments_offset, data_offset;
+};
+
+static inline size_t grt_binary_align(size_t n) { return (n+7) & ~((size_t)7); }
+
+/* read-only view of a binary dataset in memory, e.g. a mapped file */
+class BinaryDataset {
+  public:
+    grt_binary_header header;
+    std::vector<std::string> labelset;
+
+    BinaryDataset() : base(NULL), length(0) {}
+
+    static bool ismagic(const char *begin, const char *end) {
+      return (size_t)(end-begin) >= 8 && memcmp(begin, GRT_BINARY_MAGIC, 8) == 0;
+    }
+
+    /* validates the header and all section bounds */
+    bool open(const char *begin, const char *end) {
+      base = NULL; length = end-begin;
+      labelset.clear();
+
+      if (length < sizeof(header) || !ismagic(begin,end))
+        return false;
+
+      memcpy(&header, begin, sizeof(header));
+      if (header.version != GRT_BINARY_VERSION || header.byteorder != GRT_BINARY_ORDER ||
+          (header.dtype != 4 && header.dtype != 8) || (header.dims == 0 && header.rows != 0) ||
+          header.type > GRT_BINARY_CLASSIFICATION || header.rows > length ||
+          header.samples > length || header.nlabels > length ||
+          (header.type == GRT_BINARY_CLASSIFICATION && header.samples != header.rows))
+        return false;
+
+      /* the header is read from the file, so the size of the data must not
+       * wrap around */
+      uint64_t nsegments = header.type==GRT_BINARY_TIMESERIES ? header.samples+1 : 0, ndata;
+      if (__builtin_mul_overflow(header.rows, (uint64_t) header.dims, &ndata) ||
+          __builtin_mul_overflow(ndata, (uint64_t) header.dtype, &ndata))
+        return false;
+
+      if (!inside(header.sample_labels_offset, header.samples*sizeof(uint32_t)) ||
+          !inside(header.segments_offset, nsegments*sizeof(uint64_t)) ||
+          !inside(header.data_offset, ndata))
+        return false;
+
+      uint64_t off = header.labels_offset;
+      for (uint64_t i=0; i<header.nlabels; i++) {
+        uint32_t n;
+        if (!inside(off, sizeof(n))) return false;
+        memcpy(&n, begin+off, sizeof(n)); off += sizeof(n);
+        if (!inside(off, n)) return false;
+        labelset.push_back(std::string(begin+off, n)); off += n;
+      }
+
+      base = begin;
+      for (uint64_t i=0; i<header.samples; i++)
+        if (label(i) >= header.nlabels ||
+            segment_begin(i) > segment_end(i) || segment_end(i) > header.rows)
+          return base = NULL, false;
+
+      return true;
+    }
+
+    bool good() const { return base != NULL; }
+    bool timeseries() const { return header.type == GRT_BINARY_TIMESERIES; }
+
+    uint32_t label(uint64_t sample) const {
+      uint32_t l;
+      memcpy(&l, base + header.sample_labels_offset + sample*sizeof(l), sizeof(l));
+      return l;
+    }
+
+    uint64_t segment_begin(uint64_t sample) const {
+      if (!timeseries()) return sample;
+      uint64_t r;
+      memcpy(&r, base + header.segments_offset + sample*sizeof(r), sizeof(r));
+      return r;
+    }
+
+    uint64_t segment_end(uint64_t sample) const {
+      return timeseries() ? segment_begin(sample+1) : sample+1;
+    }
+
+    double value(uint64_t row, uint32_t col) const {
+      const char *p = base + header.data_offset + (col*header.rows + row)*header.dtype;
+
+      if (header.dtype == 4) {
+        float f; memcpy(&f, p, sizeof(f));
+        return f;
+      }
+
+      double d; memcpy(&d, p, sizeof(d));
+      return d;
+    }
+
+    /* copy one row into a row-major buffer of dims values */
+    void row(uint64_t r, double *dst) const {
+      for (uint32_t j=0; j<header.dims; j++)
+        dst[j] = value(r,j);
+    }
+
+  protected:
+    const char *base;
+    uint64_t length;
+
+    bool inside(uint64_t off, uint64_t n) const {
+      return off <= length && n <= length - off;
+    }
+};
+
+/* collects samples row by row and writes them in the binary format */
+class BinaryDatasetWriter {
+  public:
+    BinaryDatasetWriter(bool timeseries, bool float32) :
+      timeseries(timeseries), float32(float32), dims(0) {
+      segments.push_back(0);
+    }
+
+    /* a row that starts a new sample for classification data, or belongs to
+     * the current segment for timeseries. */
+    bool add_row(const double *vals, uint32_t n) {
+      if (dims == 0) dims = n;
+      if (n != dims) return false;
+      data.insert(data.end(), vals, vals+n);
+      return true;
+    }
+
+    /* closes the current sample (or segment) with the given label index */
+    void end_sample(uint32_t label) {
+      labels.push_back(label);
+      segments.push_back(data.size() / (dims ? dims : 1));
+    }
+
+    bool write(FILE *f, const std::vector<std::string> &labelset) {
+      grt_binary_header h;
+      memset(&h, 0, sizeof(h));
+      memcpy(h.magic, GRT_BINARY_MAGIC, sizeof(h.magic));
+      h.version   = GRT_BINARY_VERSION;
+      h.byteorder = GRT_BINARY_ORDER;
+      h.type      = timeseries ? GRT_BINARY_TIMESERIES : GRT_BINARY_CLASSIFICATION;
+      h.dtype     = float32 ? 4 : 8;
+      h.dims      = dims;
+      h.samples   = labels.size();
+      h.rows      = dims ? data.size() / dims : 0;
+      h.nlabels   = labelset.size();
+
+      size_t off = grt_binary_align(sizeof(h));
+      h.labels_offset = off;
+      for (auto &l : labelset) off += sizeof(uint32_t) + l.size();
+      h.sample_labels_offset = off = grt_binary_align(off);
+      off += labels.size() * sizeof(uint32_t);
+      h.segments_offset = off = grt_binary_align(off);
+      if (timeseries) off += segments.size() * sizeof(uint64_t);
+      h.data_offset = off = grt_binary_align(off);
+
+      size_t pos = 0;
+      bool ok = put(f, pos, &h, sizeof(h));
+      ok &= pad(f, pos, h.labels_offset);
+      for (auto &l : labelset) {
+        uint32_t n = l.size();
+        ok &= put(f, pos, &n, sizeof(n)) && put(f, pos, l.data(), n);
+      }
+      ok &= pad(f, pos, h.sample_labels_offset);
+      ok &= put(f, pos, labels.data(), labels.size()*sizeof(uint32_t));
+      ok &= pad(f, pos, h.segments_offset);
+      if (timeseries)
+        ok &= put(f, pos, segments.data(), segments.size()*sizeof(uint64_t));
+      ok &= pad(f, pos, h.data_offset);
+
+      /* transpose into columns, written through a small staging buffer */
+      char block[1<<16];
+      size_t n = 0;
+      for (uint32_t j=0; j<dims && ok; j++)
+        for (uint64_t i=0; i<h.rows && ok; i++) {
+          double d = data[i*dims + j];
+          if (float32) { float v = d; memcpy(block+n, &v, sizeof(v)); n += sizeof(v); }
+          else         { memcpy(block+n, &d, sizeof(d)); n += sizeof(d); }
+          if (n == sizeof(block)) { ok &= put(f, pos, block, n); n = 0; }
+        }
+
+      ok &= put(f, pos, block, n);
+      return ok && fflush(f) == 0;
+    }
+
+  protected:
+    bool timeseries, float32;
+    uint32_t dims;
+    std::vector<double> data;
+    std::vector<uint32_t> labels;
+    std::vector<uint64_t> segments;
+
+    static bool put(FILE *f, size_t &pos, const void *p, size_t n) {
+      pos += n;
+      return n == 0 || fwrite(p, 1, n, f) == n;
+    }
+
+    static bool pad(FILE *f, size_t &pos, size_t to) {
+      static const char zeros[8] = {0};
+      return put(f, pos, zeros, to - pos);
+    }
+};
+
+#endif
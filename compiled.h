@@ -0,0 +1,57 @@
+#ifndef _COMPILED_H_
+#define _COMPILED_H_
+
+#include "libgrt_util.h"
+
+/* Prediction of overlapping windows of a stream of frames, which keeps the
+ * work done for a frame while it is part of the window. */
+class SlidingWindow {
+  public:
+    virtual ~SlidingWindow() {}
+
+    /* adds a frame, dropping the oldest one if the window is full */
+    virtual void push(const Float *frame) = 0;
+
+    /* label of the current window, false if it can not be predicted */
+    virtual bool predict(UINT &predicted) = 0;
+};
+
+/* A classifier translated into a form that predicts many samples at once,
+ * built when a model is loaded. It gives the same labels and likelihoods as
+ * the GRT classifier it was compiled from and is read-only, so it can be
+ * shared between threads. The predict functions return false if the samples
+ * can not be predicted this way, e.g. for a wrong dimension, in which case
+ * GRT predicts them.
+ *
+ * Some compiled forms are also stored in binary models, see modelio.h, and
+ * opened from there instead of compiling the classifier again. */
+class CompiledModel {
+  public:
+    virtual ~CompiledModel() {}
+
+    /* false for approximations, whose results are not compared to GRT */
+    virtual bool exact() const { return true; }
+
+    /* adds the sections to open this model from, false if it has none */
+    virtual bool save(BinaryModelWriter &model) const {
+      return false;
+    }
+
+    virtual bool predict(VectorFloat *const *x, size_t n, UINT *predicted, Float *likelihood) const {
+      return false;
+    }
+
+    /* Timeseries. If likelihood is NULL only the labels are needed, which
+     * some models can find faster. */
+    virtual bool predict(MatrixFloat *const *x, size_t n, UINT *predicted, Float *likelihood) const {
+      return false;
+    }
+
+    /* Window of the given number of frames, or NULL if there is no gain over
+     * predicting each window as a timeseries. Like timeseries, labels only. */
+    virtual SlidingWindow *window(size_t frames) const {
+      return NULL;
+    }
+};
+
+#endif
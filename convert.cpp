@@ -0,0 +1,112 @@
+#include "libgrt_util.h"
+#include "cmdline.h"
+#include "output.h"
+
+static void print_row(FILE *out, const string &label, const double *vals, size_t n, bool single) {
+  char buf[32];
+  fputs(label.c_str(), out);
+  for (size_t j=0; j<n; j++) {
+    format_double(buf, vals[j], single);
+    fputc('\t', out);
+    fputs(buf, out);
+  }
+  fputc('\n', out);
+}
+
+int main(int argc, char *argv[])
+{
+  cmdline::parser c;
+  c.add<string>("type",       't', "force input type", false, "auto", cmdline::oneof<string>("classification", "timeseries", "auto"));
+  c.add<string>("output",     'o', "write to file instead of stdout", false);
+  c.add        ("float32",    'f', "store values as 32-bit floats in binary output");
+  c.add<int>   ("verbose",    'v', "verbosity level: 0-4", false, 0);
+  c.add        ("help",       'h', "print this message");
+  c.footer     ("[filename]...");
+
+  /* parse the classifier-common arguments */
+  if (!c.parse(argc,argv)) {
+    cerr << c.usage() << endl << c.error() << endl;
+    return -1;
+  }
+
+  if (c.exist("help")) {
+    cout << c.usage();
+    return 0;
+  }
+
+  set_verbosity(c.get<int>("verbose"));
+
+  LineReader &in = grt_lineinput(c);
+  if (!in) return -1;
+
+  FILE *out = c.exist("output") ? fopen(c.get<string>("output").c_str(), "wb") : stdout;
+  if (out == NULL) {
+    cerr << "unable to open \"" << c.get<string>("output") << "\" as output" << endl;
+    return -1;
+  }
+
+  CsvIOSample io(c.get<string>("type"));
+  BinaryDatasetWriter *writer = NULL;
+  bool first = true;
+
+  /* binary input is converted to text, text input to binary */
+  while (in >> io) {
+    if (io.binary.good()) {
+      bool single = io.binary.header.dtype == 4;
+
+      if (first && io.type == TIMESERIES)
+        fputs("# timeseries\n", out);
+
+      if (io.type == TIMESERIES) {
+        MatrixFloat &m = io.t_data.getData();
+        const string &label = io.labelset[io.t_data.getClassLabel()];
+
+        if (!first) fputc('\n', out);
+        for (UINT i=0; i<m.getNumRows(); i++)
+          print_row(out, label, m[i], m.getNumCols(), single);
+      } else {
+        VectorFloat &v = io.c_data.getSample();
+        print_row(out, io.labelset[io.c_data.getClassLabel()], &v[0], v.size(), single);
+      }
+    } else {
+      bool ok = true;
+
+      if (writer == NULL)
+        writer = new BinaryDatasetWriter(io.type == TIMESERIES, c.exist("float32"));
+
+      if (io.type == TIMESERIES) {
+        MatrixFloat &m = io.t_data.getData();
+        for (UINT i=0; i<m.getNumRows() && ok; i++)
+          ok = writer->add_row(m[i], m.getNumCols());
+        writer->end_sample(io.t_data.getClassLabel());
+      } else {
+        VectorFloat &v = io.c_data.getSample();
+        ok = writer->add_row(&v[0], v.size());
+        writer->end_sample(io.c_data.getClassLabel());
+      }
+
+      if (!ok) {
+        cerr << "error at line " << io.linenum << ": number of dimensions changed" << endl;
+        return -1;
+      }
+    }
+
+    first = false;
+  }
+
+  if (io.errline != 0) {
+    cerr << "error at line " << io.errline << ": number of dimensions changed" << endl;
+    return -1;
+  }
+
+  if (writer != NULL &&
+      !writer->write(out, vector<string>(io.labelset.begin(), io.labelset.end()))) {
+    cerr << "unable to write binary dataset" << endl;
+    return -1;
+  }
+
+  if (out != stdout)
+    fclose(out);
+
+  return 0;
+}
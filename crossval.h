@@ -0,0 +1,266 @@
+#ifndef _CROSSVAL_H_
+#define _CROSSVAL_H_
+
+#include "libgrt_util.h"
+#include <iomanip>
+#include <random>
+#include <map>
+
+/* confusion counts of one fold, indexed by [label][prediction] */
+typedef vector< vector<uint64_t> > Confusion;
+
+/* Splits are kept as lists of sample indices into the one loaded dataset,
+ * so selecting a part of it does not copy any samples. */
+typedef vector<UINT> Indices;
+
+static bool predict_sample(Classifier *c, ClassificationSample &s) {
+  return c->predict(s.getSample());
+}
+
+static bool predict_sample(Classifier *c, TimeSeriesClassificationSample &s) {
+  return c->predict(s.getData());
+}
+
+static bool add_sample(ClassificationData &d, ClassificationSample &s) {
+  return d.addSample(s.getClassLabel(), s.getSample());
+}
+
+static bool add_sample(TimeSeriesClassificationData &d, TimeSeriesClassificationSample &s) {
+  return d.addSample(s.getClassLabel(), s.getData());
+}
+
+/* The one generator for splits and random search trials. It has a fixed
+ * seed unless given another one, so that the folds of -n k.x are the same
+ * in every process that is run for one of them. */
+static std::mt19937& split_random() {
+  static std::mt19937 rng(0);
+  return rng;
+}
+
+static void seed_split_random(unsigned seed) {
+  split_random().seed(seed);
+}
+
+/* Stratified random split, the given ratio of each class is kept for
+ * training. Returns the indices of all other samples in ascending order. */
+template<class Data>
+Indices random_split(Data &data, double ratio)
+{
+  map<UINT, Indices> strata;
+  Indices test;
+
+  for (UINT i=0; i<data.getNumSamples(); i++)
+    strata[data[i].getClassLabel()].push_back(i);
+
+  for (auto &s : strata) {
+    Indices &v = s.second;
+    shuffle(v.begin(), v.end(), split_random());
+    test.insert(test.end(), v.begin() + (size_t) floor(v.size() * ratio), v.end());
+  }
+
+  sort(test.begin(), test.end());
+  return test;
+}
+
+/* Randomly assigns the samples to k folds whose sizes differ by at most one,
+ * the indices of each fold are in ascending order. Returns no folds if there
+ * are fewer samples than folds. */
+template<class Data>
+vector<Indices> kfold_split(Data &data, UINT k)
+{
+  UINT n = data.getNumSamples();
+  if (k < 2 || k > n)
+    return vector<Indices>();
+
+  Indices order(n);
+  for (UINT i=0; i<n; i++) order[i] = i;
+  shuffle(order.begin(), order.end(), split_random());
+
+  vector<Indices> folds(k);
+  for (UINT i=0; i<n; i++)
+    folds[i % k].push_back(order[i]);
+  for (auto &f : folds)
+    sort(f.begin(), f.end());
+
+  return folds;
+}
+
+/* Copies the samples at the (ascending) indices into removed and drops them
+ * from data, which is compacted in place. Only the removed samples are ever
+ * copied, so data can be trained on afterwards without another copy. */
+template<class Data, class Sample>
+void split_off(Data &data, const Indices &indices, vector<Sample> &removed)
+{
+  UINT n = data.getNumSamples(), w = 0;
+  size_t next = 0;
+
+  removed.reserve(removed.size() + indices.size());
+  for (UINT i : indices)
+    removed.push_back(data[i]);
+
+  /* swapping keeps the removed samples (and their labels) at the end, where
+   * they can be popped without breaking the per-class counts */
+  for (UINT i=0; i<n; i++) {
+    if (next < indices.size() && indices[next] == i) {
+      next++;
+      continue;
+    }
+    if (w != i)
+      std::swap(data[w], data[i]);
+    w++;
+  }
+
+  while (data.getNumSamples() > w)
+    data.removeLastSample();
+}
+
+/* Trains a copy of the (untrained) prototype on all but one of the folds and
+ * evaluates it on the remaining one, up to threads folds at the same time (0
+ * for all cores). The training set of a fold is the only copy made, test
+ * samples are predicted in place. Returns false if any fold could not be
+ * trained. */
+template<class Data>
+bool cross_validate(Classifier *prototype, Data &data, const vector<Indices> &split,
+                    UINT nlabels, int threads, vector<Confusion> &folds)
+{
+  UINT k = split.size();
+  if (k < 2)
+    return false;
+
+  if (threads <= 0)
+    threads = thread::hardware_concurrency();
+  threads = std::max(1, std::min(threads, (int) k));
+
+  folds.assign(k, Confusion(nlabels, vector<uint64_t>(nlabels, 0)));
+  vector<char> trained(k, false);
+  atomic<UINT> next(0);
+  vector<thread> pool;
+
+  for (int t=0; t<threads; t++)
+    pool.push_back(thread([&]() {
+      for (UINT f; (f = next++) < k; ) {
+        Classifier *classifier = prototype->deepCopy();
+        Data training;
+        vector<char> test(data.getNumSamples(), false);
+
+        for (UINT i : split[f])
+          test[i] = true;
+
+        training.setAllowNullGestureClass(true);
+        training.setNumDimensions(data.getNumDimensions());
+        for (UINT i=0; i<data.getNumSamples(); i++)
+          if (!test[i]) add_sample(training, data[i]);
+
+        if (classifier == NULL || !classifier->train_(training)) {
+          if (classifier != NULL) delete classifier;
+          continue;
+        }
+
+        for (UINT i : split[f]) {
+          UINT label = data[i].getClassLabel();
+          if (!predict_sample(classifier, data[i]))
+            continue;
+          UINT prediction = classifier->getPredictedClassLabel();
+          if (label < nlabels && prediction < nlabels)
+            folds[f][label][prediction]++;
+        }
+
+        trained[f] = true;
+        delete classifier;
+      }
+    }));
+
+  for (auto &th : pool)
+    th.join();
+
+  return find(trained.begin(), trained.end(), false) == trained.end();
+}
+
+/* same as above for a random split into k folds */
+template<class Data>
+bool cross_validate(Classifier *prototype, Data &data, UINT k, UINT nlabels,
+                    int threads, vector<Confusion> &folds)
+{
+  return cross_validate(prototype, data, kfold_split(data, k), nlabels, threads, folds);
+}
+
+/* accuracy and F1 averaged over all classes seen in the confusion matrix */
+static void confusion_scores(const Confusion &m, uint64_t &n, double &accuracy, double &f1)
+{
+  uint64_t correct = 0, classes = 0;
+  double sum = 0;
+  n = 0;
+
+  for (size_t i=0; i<m.size(); i++) {
+    uint64_t tp = m[i][i], predicted = 0, actual = 0;
+    for (size_t j=0; j<m.size(); j++) {
+      predicted += m[j][i];
+      actual    += m[i][j];
+    }
+
+    n += actual;
+    correct += tp;
+    if (predicted + actual == 0)
+      continue;
+
+    sum += 2.*tp / (predicted + actual);
+    classes++;
+  }
+
+  accuracy = n ? (double) correct / n : 0;
+  f1 = classes ? sum / classes : 0;
+}
+
+/* per-fold scores followed by the confusion matrix summed over all folds */
+static void print_cross_validation(ostream &out, const vector<Confusion> &folds, const LabelSet &labels)
+{
+  if (folds.size() == 0)
+    return;
+
+  size_t nlabels = folds[0].size();
+  Confusion all(nlabels, vector<uint64_t>(nlabels, 0));
+  uint64_t n;
+  double accuracy, f1;
+
+  ios::fmtflags flags = out.flags();
+  streamsize precision = out.precision();
+  out << "fold\tsamples\taccuracy\tF1" << endl;
+  out << fixed << setprecision(6);
+
+  for (size_t f=0; f<folds.size(); f++) {
+    confusion_scores(folds[f], n, accuracy, f1);
+    out << f << "\t" << n << "\t" << accuracy << "\t" << f1 << endl;
+
+    for (size_t i=0; i<nlabels; i++)
+      for (size_t j=0; j<nlabels; j++)
+        all[i][j] += folds[f][i][j];
+  }
+
+  confusion_scores(all, n, accuracy, f1);
+  out << "all\t" << n << "\t" << accuracy << "\t" << f1 << endl << endl;
+  out.flags(flags);
+  out.precision(precision);
+
+  /* only labels that occur as ground truth or prediction are listed */
+  vector<size_t> seen;
+  for (size_t i=0; i<nlabels; i++) {
+    uint64_t s = 0;
+    for (size_t j=0; j<nlabels; j++)
+      s += all[i][j] + all[j][i];
+    if (s) seen.push_back(i);
+  }
+
+  out << "confusion";
+  for (size_t i : seen)
+    out << "\t" << labels[i];
+  out << endl;
+
+  for (size_t i : seen) {
+    out << labels[i];
+    for (size_t j : seen)
+      out << "\t" << all[i][j];
+    out << endl;
+  }
+}
+
+#endif
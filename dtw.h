@@ -0,0 +1,384 @@
+#ifndef _DTW_H_
+#define _DTW_H_
+
+#include "compiled.h"
+#include <cmath>
+#include <cfloat>
+#include <limits>
+
+/* DTW models compiled for finding the label only. GRT warps the sample
+ * against every template and takes the nearest one, where the distance is
+ * the mean of the accumulated cost along the warping path. Since the cost
+ * accumulates along the path, the first cell counts fully and a cell that
+ * is s steps into a path of length L counts with (L-s)/L, which gives lower
+ * bounds on the distance. The templates are tried in the order of a cheap
+ * bound:
+ *
+ *  - LB_Kim: the first pair of frames, and the last one with 1/(M+N-1)
+ *  - LB_Keogh: the distance of each frame to the range of the other series,
+ *    weighted by the least number of steps left after it
+ *
+ * and each template whose bound is not below the nearest distance found so
+ * far is skipped. Otherwise, the cost is accumulated row by row and
+ * abandoned once the rows so far show that it can not get below.
+ *
+ * The costs are added up and the path is traced back exactly like GRT
+ * does, so the nearest template, its distance and the null rejection are
+ * the same. Likelihoods need the distance of all templates and are left to
+ * GRT, as are models with a warping radius: GRT then also reads cells
+ * outside the radius when tracing back the path, which these bounds do not
+ * hold for.
+ *
+ * Overlapping windows of a stream share most of their frames, so a window
+ * keeps the costs of each frame against all template rows and only
+ * computes those of the frames added since the last window. */
+class DtwSearch : public CompiledModel {
+  public:
+    /* returns NULL if the classifier can not be compiled */
+    static DtwSearch *compile(Classifier *classifier) {
+      DTW *dtw = dynamic_cast<DTW*>(classifier);
+
+      if (dtw == NULL || !dtw->getTrained() || dtw->getNumInputDimensions() == 0)
+        return NULL;
+
+      Vector<DTWTemplate> &buffer = DTWAccess::templates(dtw);
+      DtwSearch *d = new DtwSearch;
+      d->dims       = dtw->getNumInputDimensions();
+      d->distance   = DTWAccess::distance(dtw);
+      d->rejection  = dtw->getNullRejectionEnabled();
+      d->thresholds = dtw->getNullRejectionThresholds();
+
+      bool ok = !dtw->getScalingEnabled() && !DTWAccess::preprocessed(dtw) &&
+                !DTWAccess::constrained(dtw) &&
+                (d->distance == DTW::ABSOLUTE_DIST || d->distance == DTW::EUCLIDEAN_DIST) &&
+                (!d->rejection || DTWAccess::rejection(dtw) == DTW::TEMPLATE_THRESHOLDS) &&
+                buffer.size() > 0 &&
+                (!d->rejection || d->thresholds.size() == buffer.size());
+
+      for (size_t k=0; ok && k<buffer.size(); k++) {
+        DTWTemplate &t = buffer[k];
+        Template flat;
+        flat.label = t.classLabel;
+        flat.rows  = t.timeSeries.getNumRows();
+        flat.lo.assign(d->dims,  numeric_limits<Float>::infinity());
+        flat.hi.assign(d->dims, -numeric_limits<Float>::infinity());
+
+        ok = flat.rows > 0 && t.timeSeries.getNumCols() == d->dims;
+        for (size_t i=0; ok && i<flat.rows; i++)
+          for (size_t j=0; j<d->dims; j++) {
+            Float v = t.timeSeries[i][j];
+            ok = ok && std::isfinite(v);
+            flat.data.push_back(v);
+            flat.lo[j] = std::min(flat.lo[j], v);
+            flat.hi[j] = std::max(flat.hi[j], v);
+          }
+
+        d->templates.push_back(flat);
+      }
+
+      if (!ok) {
+        delete d;
+        return NULL;
+      }
+
+      return d;
+    }
+
+    bool predict(MatrixFloat *const *x, size_t n, UINT *predicted, Float *likelihood) const {
+      if (likelihood != NULL)
+        return false;
+
+      for (size_t i=0; i<n; i++) {
+        MatrixFloat &m = *x[i];
+        size_t rows = m.getNumRows();
+        vector<Float> sample;
+
+        if (rows == 0 || m.getNumCols() != dims)
+          return false;
+
+        for (size_t r=0; r<rows; r++)
+          for (size_t j=0; j<dims; j++) {
+            if (!std::isfinite(m[r][j]))
+              return false;
+            sample.push_back(m[r][j]);
+          }
+
+        SampleCosts costs(*this, &sample[0]);
+        if (!nearest(rows, costs, predicted[i]))
+          return false;
+      }
+
+      return true;
+    }
+
+    SlidingWindow *window(size_t frames) const {
+      return frames > 0 ? new Window(*this, frames) : NULL;
+    }
+
+  protected:
+    /* DTW keeps its templates and settings protected, member pointers
+     * reach them */
+    struct DTWAccess : DTW {
+      static Vector<DTWTemplate> &templates(DTW *dtw) { return dtw->*(&DTWAccess::templatesBuffer); }
+      static UINT distance(DTW *dtw)  { return dtw->*(&DTWAccess::distanceMethod); }
+      static UINT rejection(DTW *dtw) { return dtw->*(&DTWAccess::rejectionMode); }
+      static bool constrained(DTW *dtw) { return dtw->*(&DTWAccess::constrainWarpingPath); }
+      static bool preprocessed(DTW *dtw) {
+        return dtw->*(&DTWAccess::useZNormalisation) || dtw->*(&DTWAccess::useSmoothing) ||
+               dtw->*(&DTWAccess::offsetUsingFirstSample);
+      }
+    };
+
+    struct Template {
+      UINT label;
+      size_t rows;
+      vector<Float> data;   // rows x dims
+      vector<Float> lo, hi; // range of each dimension
+    };
+
+    size_t dims;
+    UINT distance;
+    bool rejection;
+    VectorFloat thresholds;
+    vector<Template> templates;
+
+    Float cost(const Float *a, const Float *b) const {
+      Float d = 0;
+      if (distance == DTW::EUCLIDEAN_DIST) {
+        for (size_t k=0; k<dims; k++)
+          d += (a[k] - b[k]) * (a[k] - b[k]);
+        return sqrt(d);
+      }
+      for (size_t k=0; k<dims; k++)
+        d += fabs(a[k] - b[k]);
+      return d;
+    }
+
+    /* cost of a frame to the nearest point of a range */
+    Float cost(const Float *a, const Float *lo, const Float *hi) const {
+      Float d = 0;
+      for (size_t k=0; k<dims; k++) {
+        Float e = a[k] < lo[k] ? lo[k] - a[k] : a[k] > hi[k] ? a[k] - hi[k] : 0;
+        d += distance == DTW::EUCLIDEAN_DIST ? e*e : e;
+      }
+      return distance == DTW::EUCLIDEAN_DIST ? sqrt(d) : d;
+    }
+
+    /* The costs of a sample of N frames against the templates, computed
+     * when needed. Frame j of the sample is at x + j*dims. */
+    struct SampleCosts {
+      const DtwSearch &d;
+      const Float *x;
+
+      SampleCosts(const DtwSearch &d, const Float *x) : d(d), x(x) {}
+
+      const Float *frame(size_t j) const { return x + j*d.dims; }
+
+      /* of row i of template t and frame j */
+      Float cell(size_t t, size_t i, size_t j) const {
+        return d.cost(&d.templates[t].data[i*d.dims], frame(j));
+      }
+
+      /* of frame j and the range of template t */
+      Float envelope(size_t t, size_t j) const {
+        return d.cost(frame(j), &d.templates[t].lo[0], &d.templates[t].hi[0]);
+      }
+    };
+
+    /* frames in a ring buffer, with their costs against every template */
+    class Window : public SlidingWindow {
+      public:
+        Window(const DtwSearch &d, size_t size) : d(d), size(size), head(0), count(0), finite(0), rows(0) {
+          for (auto &t : d.templates) {
+            offsets.push_back(rows);
+            rows += t.rows;
+          }
+          frames.resize(size * d.dims);
+          cells.resize(size * rows);
+          envelopes.resize(size * d.templates.size());
+          valid.resize(size);
+        }
+
+        void push(const Float *frame) {
+          size_t slot = (head + count) % size;
+          if (count == size) {
+            finite -= valid[head];
+            head = (head + 1) % size;
+          } else
+            count++;
+
+          std::copy(frame, frame + d.dims, &frames[slot * d.dims]);
+          valid[slot] = true;
+          for (size_t k=0; k<d.dims; k++)
+            valid[slot] = valid[slot] && std::isfinite(frame[k]);
+          finite += valid[slot];
+
+          for (size_t t=0; t<d.templates.size(); t++) {
+            const Template &tm = d.templates[t];
+            for (size_t i=0; i<tm.rows; i++)
+              cells[slot*rows + offsets[t] + i] = d.cost(&tm.data[i*d.dims], &frames[slot * d.dims]);
+            envelopes[slot*d.templates.size() + t] = d.cost(&frames[slot * d.dims], &tm.lo[0], &tm.hi[0]);
+          }
+        }
+
+        bool predict(UINT &predicted) {
+          if (count == 0 || finite != count)
+            return false;
+
+          slots.resize(count);
+          for (size_t j=0; j<count; j++)
+            slots[j] = (head + j) % size;
+
+          return d.nearest(count, *this, predicted);
+        }
+
+        const Float *frame(size_t j) const { return &frames[slots[j] * d.dims]; }
+
+        Float cell(size_t t, size_t i, size_t j) const {
+          return cells[slots[j]*rows + offsets[t] + i];
+        }
+
+        Float envelope(size_t t, size_t j) const {
+          return envelopes[slots[j]*d.templates.size() + t];
+        }
+
+      protected:
+        const DtwSearch &d;
+        size_t size, head, count, finite, rows;
+        vector<size_t> offsets, slots;
+        vector<Float> frames, cells, envelopes;
+        vector<char> valid;
+    };
+
+    /* false if nothing can be said, e.g. when a distance is not finite */
+    template<class Costs>
+    bool nearest(size_t N, const Costs &costs, UINT &predicted) const {
+      vector<Float> lo(dims, numeric_limits<Float>::infinity()), hi(dims, -numeric_limits<Float>::infinity());
+      vector< pair<Float, size_t> > order;
+      vector<Float> D;
+
+      for (size_t j=0; j<N; j++)
+        for (size_t k=0; k<dims; k++) {
+          lo[k] = std::min(lo[k], costs.frame(j)[k]);
+          hi[k] = std::max(hi[k], costs.frame(j)[k]);
+        }
+
+      for (size_t t=0; t<templates.size(); t++) {
+        const Template &tm = templates[t];
+        size_t M = tm.rows;
+        Float steps = M + N - 1,
+              first = costs.cell(t, 0, 0),
+              kim   = steps == 1 ? first : first + costs.cell(t, M-1, N-1) / steps,
+              input = first, templ = first;
+
+        for (size_t j=1; j<N; j++)
+          input += costs.envelope(t, j) * (N-j) / steps;
+        for (size_t i=1; i<M; i++)
+          templ += cost(&tm.data[i*dims], &lo[0], &hi[0]) * (M-i) / steps;
+
+        order.push_back(make_pair(std::max(kim, std::max(input, templ)), t));
+      }
+
+      sort(order.begin(), order.end());
+
+      /* the first template of the least distance, as GRT picks it */
+      Float best = numeric_limits<Float>::infinity();
+      size_t nearest = templates.size();
+
+      for (auto &o : order) {
+        if (nearest < templates.size() && o.first > best * (1 + 1e-9))
+          break;
+
+        Float d = warp(o.second, N, costs, nearest < templates.size() ? best : numeric_limits<Float>::infinity(), D);
+        if (std::isnan(d))
+          return false;
+        if (nearest == templates.size() || d < best || (d == best && o.second < nearest)) {
+          best = d;
+          nearest = o.second;
+        }
+      }
+
+      predicted = templates[nearest].label;
+      if (rejection && !(best <= thresholds[nearest]))
+        predicted = 0;
+      return true;
+    }
+
+    /* The distance of GRT, or infinity once it is certainly above bound.
+     * The least cost of each row does not decrease from row to row, and
+     * each row has at least one cell on the path of at most M+N-1 cells,
+     * the others count at least as much as the first row. */
+    template<class Costs>
+    Float warp(size_t t, size_t N, const Costs &costs, Float bound, vector<Float> &D) const {
+      size_t M = templates[t].rows;
+      Float steps = M + N - 1, rows = 0, first = 0;
+
+      D.resize(M*N);
+
+      for (size_t i=0; i<M; i++) {
+        Float least = numeric_limits<Float>::infinity();
+
+        for (size_t j=0; j<N; j++) {
+          Float c = costs.cell(t, i, j), d;
+
+          if (i == 0 && j == 0)
+            d = c;
+          else if (i == 0)
+            d = c + D[j-1];
+          else if (j == 0)
+            d = c + D[(i-1)*N];
+          else {
+            Float m = DBL_MAX;
+            bool any = false;
+            if (D[(i-1)*N + j-1] < m) { m = D[(i-1)*N + j-1]; any = true; }
+            if (D[(i-1)*N + j]   < m) { m = D[(i-1)*N + j];   any = true; }
+            if (D[i*N + j-1]     < m) { m = D[i*N + j-1];     any = true; }
+            d = any ? c + m : 0;
+          }
+
+          D[i*N + j] = d;
+          least = std::min(least, d);
+        }
+
+        if (i == 0)
+          first = least;
+        rows += least;
+
+        if ((rows + (M-1-i) * least + (N-1) * first) / steps > bound * (1 + 1e-9))
+          return numeric_limits<Float>::infinity();
+      }
+
+      if (!std::isfinite(sqrt(D[M*N-1])))
+        return numeric_limits<Float>::infinity();
+
+      /* trace back the path like GRT, preferring the diagonal on ties */
+      size_t i = M-1, j = N-1;
+      Float total = D[i*N + j], length = 1;
+
+      while (i != 0 || j != 0) {
+        if (i == 0)
+          j--;
+        else if (j == 0)
+          i--;
+        else {
+          Float v = DBL_MAX;
+          int step = 0;
+          if (D[(i-1)*N + j] < v)    { v = D[(i-1)*N + j]; step = 1; }
+          if (D[i*N + j-1] < v)      { v = D[i*N + j-1];   step = 2; }
+          if (D[(i-1)*N + j-1] <= v) step = 3;
+
+          if (step == 0)
+            return numeric_limits<Float>::infinity();
+          if (step != 2) i--;
+          if (step != 1) j--;
+        }
+
+        length++;
+        total += D[i*N + j];
+      }
+
+      return total / length;
+    }
+};
+
+#endif
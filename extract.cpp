@@ -1,4 +1,8 @@
 #include "cmdline.h"
+#include "labelset.h"
+#include "linereader.h"
+#include "binio.h"
+#include "output.h"
 #include <cmath>
 #include <errno.h>
 #include <limits.h>
@@ -8,18 +12,61 @@
 using namespace std;
 
 typedef struct matrix {
-  size_t dimv, diml, nlabels, allocd;
+  size_t dimv, diml, allocd;
   double *vals;
-  char   **labels;
-  char   **labelset;
+  uint32_t *labels;
+  LabelSet labelset;
 } matrix_t;
 
+// binary datasets are returned segment-wise, or as a single block of all
+// rows for classification data, which is what the text form would give
+matrix_t*
+read_binary_matrix(BinaryDataset &b, matrix_t *m)
+{
+  static uint64_t segment = 0;
+  static vector<uint32_t> ids;
+  uint64_t first, last;
+
+  if (ids.size() == 0)
+    for (size_t j=0; j<b.labelset.size(); j++)
+      ids.push_back(m->labelset.intern(b.labelset[j]));
+
+  if (b.timeseries()) {
+    if (segment >= b.header.samples) return NULL;
+    first = b.segment_begin(segment);
+    last  = b.segment_end(segment++);
+  } else {
+    if (segment++ > 0 || b.header.rows == 0) return NULL;
+    first = 0;
+    last  = b.header.rows;
+  }
+
+  m->dimv = b.header.dims;
+  m->diml = last - first;
+
+  if (m->allocd < m->diml) {
+    m->allocd = m->diml;
+    m->labels = (uint32_t*) realloc(m->labels, m->allocd * sizeof(m->labels[0]));
+    m->vals   = (double*) realloc(m->vals, m->allocd * m->dimv * sizeof(m->vals[0]));
+  }
+
+  for (uint64_t r=first, s=b.timeseries() ? segment-1 : 0; r<last; r++) {
+    while (s < b.header.samples && b.segment_end(s) <= r) s++;
+    m->labels[r-first] = ids[b.label(s)];
+    b.row(r, m->vals + (r-first)*m->dimv);
+  }
+
+  return m;
+}
+
 matrix_t*
 read_matrix(vector<string> filenames, matrix_t *m)
 {
   #define DELIM " \t"
   static size_t i   = 0;
   static FILE *file = NULL;
+  static LineReader input;
+  static BinaryDataset binary;
 
   if (file == NULL) {
     static string filename = filenames[i];
@@ -29,8 +76,23 @@ read_matrix(vector<string> filenames, matrix_t *m)
       fprintf(stderr, "unable to open file: %s\n%s\n", filename.c_str(), strerror(errno));
       exit(-1);
     }
+
+    // binary datasets are detected by their first byte
+    int first = getc(file);
+    ungetc(first, file);
+
+    if (first == (unsigned char) GRT_BINARY_MAGIC[0]) {
+      input.open(file);
+      if (!input.slurp() || !binary.open(input.data(), input.data_end())) {
+        fprintf(stderr, "ERR: invalid binary dataset: %s\n", filename.c_str());
+        exit(-1);
+      }
+    }
   }
 
+  if (binary.good())
+    return read_binary_matrix(binary, m);
+
   char l[LINE_MAX],c;
   size_t dim=0;
 
@@ -50,24 +112,12 @@ read_matrix(vector<string> filenames, matrix_t *m)
     // resize storage space if required
     if (m->allocd <= m->diml) {
       m->allocd = m->allocd==0 ? 1 : m->allocd*2;
-      m->labels = (char**) realloc(m->labels, m->allocd * sizeof(m->labels[0]));
+      m->labels = (uint32_t*) realloc(m->labels, m->allocd * sizeof(m->labels[0]));
       m->vals   = (double*) realloc(m->vals, m->allocd * m->dimv * sizeof(m->vals[0]));
     }
 
-    // first field is always a label, check if we've
-    // already seen this one and store accordingly
-    for (i=0; i<m->nlabels; i++)
-      if (strcmp(m->labelset[i],tok)==0) {
-        m->labels[m->diml] = m->labelset[i];
-        break;
-      }
-
-    // labelset does not contain label yet
-    if (i==m->nlabels) {
-      m->labelset = (char**) realloc(m->labelset, (m->nlabels+1) * sizeof(m->labelset[0]));
-      m->labels[m->diml] = strdup(tok);
-      m->labelset[m->nlabels++] = m->labels[m->diml];
-    }
+    // first field is always a label, stored as its id in the labelset
+    m->labels[m->diml] = m->labelset.intern(tok);
 
     // now we read all the floats into the data array
     dim = 0; while(tok=strsep(&saveptr, DELIM"\n")) {
@@ -107,12 +157,20 @@ read_matrix(vector<string> filenames, matrix_t *m)
   return m->diml==0 ? NULL : m;
 }
 
-char*
-zcr(matrix_t *m, char *s, size_t max)
+/* appends a feature value and its separator */
+static void
+put_value(string &s, double v)
+{
+  char buf[32];
+  s.append(buf, format_double(buf, v));
+  s += '\t';
+}
+
+void
+zcr(matrix_t *m, string &s)
 {
   double results[m->dimv]; memset(results, 0, sizeof(double)*m->dimv);
     bool signs[m->dimv];
-  size_t n = 0;
 
   for (size_t j=0; j<m->dimv; j++)
     signs[j] = signbit(m->vals[j]);
@@ -125,9 +183,7 @@ zcr(matrix_t *m, char *s, size_t max)
     }
 
   for (size_t j=0; j<m->dimv; j++)
-    n += snprintf(s+n, max-n, "%g\t", results[j]);
-
-  return s;
+    put_value(s, results[j]);
 }
 
 double*
@@ -145,18 +201,15 @@ _mean(matrix_t *m, double *results)
   return results;
 }
 
-char*
-mean(matrix_t *m, char *s, size_t max)
+void
+mean(matrix_t *m, string &s)
 {
   double results[m->dimv];
-  size_t n=0;
 
   _mean(m, results);
 
   for (size_t j=0; j<m->dimv; j++)
-    n += snprintf(s+n, max-n, "%g\t", results[j]);
-
-  return s;
+    put_value(s, results[j]);
 }
 
 double*
@@ -178,23 +231,19 @@ _variance(matrix_t *m, double *results)
   return results;
 }
 
-char*
-variance(matrix_t *m, char* s, size_t max)
+void
+variance(matrix_t *m, string &s)
 {
   double var[m->dimv]; _variance(m, var);
-  size_t n=0;
 
   // and convert to string
   for (size_t j=0; j<m->dimv; j++)
-    n += snprintf(s+n, max-n, "%g\t", var[j]);
-
-  return s;
+    put_value(s, var[j]);
 }
 
-char*
-range(matrix_t *m, char* s, size_t max)
+void
+range(matrix_t *m, string &s)
 {
-  size_t n=0;
   double maximum[m->dimv],
          minimum[m->dimv],
          span[m->dimv];
@@ -214,10 +263,11 @@ range(matrix_t *m, char* s, size_t max)
   for (size_t j=0; j<m->dimv; j++)
     span[j] = abs(maximum[j]) + abs(minimum[j]);
 
-  for (size_t j=0; j<m->dimv; j++)
-    n += snprintf(s+n, max-n, "%g\t%g\t%g\t", maximum[j],minimum[j],span[j]);
-
-  return s;
+  for (size_t j=0; j<m->dimv; j++) {
+    put_value(s, maximum[j]);
+    put_value(s, minimum[j]);
+    put_value(s, span[j]);
+  }
 }
 
 /*
@@ -278,26 +328,22 @@ double quickselect(double arr[], size_t n, size_t step)
 }
 #undef ELEM_SWAP
 
-char*
-median(matrix_t *m, char* s, size_t max)
+void
+median(matrix_t *m, string &s)
 {
   double results[m->dimv];
-  size_t n=0;
 
   for (size_t j=0; j<m->dimv; j++)
     results[j] = quickselect(m->vals+j, m->diml, m->dimv);
 
   for (size_t j=0; j<m->dimv; j++)
-    n += snprintf(s+n, max-n, "%g\t", results[j]);
-
-  return s;
+    put_value(s, results[j]);
 }
 
-char*
-rms(matrix_t *m, char* s, size_t max)
+void
+rms(matrix_t *m, string &s)
 {
   double results[m->dimv+1];
-  size_t n=0;
 
   for (size_t i=0; i<m->diml; i++) {
     for (size_t j=0; j<m->dimv; j++)
@@ -311,24 +357,18 @@ rms(matrix_t *m, char* s, size_t max)
     results[j] = sqrt(results[j]);
 
   for (size_t j=0; j<m->dimv+1; j++)
-    n += snprintf(s+n, max-n, "%g\t", results[j]);
-
-  return s;
+    put_value(s, results[j]);
 }
 
-char*
-timedomain(matrix_t *m, char* s, size_t max)
+void
+timedomain(matrix_t *m, string &s)
 {
-# define calc(f) f(m, s+strlen(s), max-strlen(s))
-
-  mean(m, s, max);
-  calc(variance);
-  calc(range);
-  calc(median);
-  calc(zcr);
-  calc(rms);
-
-  return s;
+  mean(m, s);
+  variance(m, s);
+  range(m, s);
+  median(m, s);
+  zcr(m, s);
+  rms(m, s);
 }
 
 matrix_t*
@@ -362,7 +402,7 @@ o_normalize(matrix_t *m)
   return m;
 }
 
-typedef char* (*process_call_t)(matrix_t*, char*, size_t);
+typedef void (*process_call_t)(matrix_t*, string&);
 struct extractor {
   const char *shorthand, *name, *desc;
   process_call_t call;
@@ -447,21 +487,20 @@ int main(int argc, const char *argv[]) {
   }
 
   matrix_t m = {0};
-  char out[LINE_MAX], l[LINE_MAX];
+  string out;
+  buffer_stdout();
 
   // print optional header
   if (!c.exist("no-header")) {
-    size_t n=0;
     for(size_t i=0; i<num_processors; i++)
-      n += snprintf(out+n,sizeof(out)-n,"%s\t", processors[i].name);
-    printf("# %s\n",out);
+      out += string(processors[i].name) + "\t";
+    cout << "# " << out << endl;
   }
 
   while ( read_matrix({c.get<string>("input")},&m) )
   {
-    size_t n=0;
     if (m.diml == 0)
-      printf("\n");
+      cout << endl;
     else {
       if (c.exist("z-normalize"))
         z_normalize(&m);
@@ -469,10 +508,11 @@ int main(int argc, const char *argv[]) {
       else if (c.exist("o-normalize"))
         o_normalize(&m);
 
+      out.clear();
       for(size_t i=0; i<num_processors; i++)
-        n += snprintf(out+n,sizeof(out)-n,"%s", processors[i].call(&m,l,sizeof(l)));
+        processors[i].call(&m,out);
 
-      printf("%s\t%s\n", m.labels[m.diml-1], out);
+      cout << m.labelset[m.labels[m.diml-1]] << "\t" << out << endl;
     }
   }
 }
@@ -0,0 +1,684 @@
+#ifndef _FILTERS_H_
+#define _FILTERS_H_
+
+#include "libgrt_util.h"
+#include <map>
+#include <memory>
+#include <deque>
+
+/* A pre-processor translated into a filter over blocks of frames, built
+ * once the number of channels is known. A block holds frames one after the
+ * other with the channels of a frame next to each other, which is how they
+ * are read, and is filtered in place. Each frame is filtered in a loop over
+ * its channels, which the compiler turns into vector instructions, instead
+ * of a call to GRT per frame. The output is that of GRT up to rounding. */
+class BlockFilter {
+  public:
+    BlockFilter(size_t channels) : channels(channels) {}
+    virtual ~BlockFilter() {}
+
+    virtual void process(Float *block, size_t frames) = 0;
+
+    /* back to the state before the first frame, like PreProcessing::reset() */
+    virtual void reset() = 0;
+
+    /* number of frames it takes to fill the filter's buffers */
+    virtual size_t history() const { return 1; }
+
+  protected:
+    size_t channels;
+};
+
+/* The mean of the last size frames, or of all of them while there are
+ * fewer. The sums are kept up to date with each frame and summed up again
+ * each time the buffer wraps around, so rounding errors do not pile up. */
+class RunningMean {
+  public:
+    RunningMean(size_t size, size_t channels)
+      : size(std::max(size, (size_t) 1)), channels(channels), head(0), count(0),
+        buffer(this->size * channels, 0), sum(channels, 0) {}
+
+    /* replaces the frame x with the mean */
+    void push(Float *x) {
+      Float *slot = &buffer[head * channels], *s = &sum[0];
+
+      for (size_t c=0; c<channels; c++) {
+        s[c] += x[c] - slot[c];
+        slot[c] = x[c];
+      }
+
+      head = (head + 1) % size;
+      count = std::min(count + 1, size);
+
+      if (head == 0)
+        resum();
+
+      Float n = count;
+      for (size_t c=0; c<channels; c++)
+        x[c] = s[c] / n;
+    }
+
+    void reset() {
+      head = count = 0;
+      std::fill(buffer.begin(), buffer.end(), 0);
+      std::fill(sum.begin(), sum.end(), 0);
+    }
+
+  protected:
+    size_t size, channels, head, count;
+    vector<Float> buffer, sum;
+
+    void resum() {
+      std::fill(sum.begin(), sum.end(), 0);
+      for (size_t i=0; i<size; i++)
+        for (size_t c=0; c<channels; c++)
+          sum[c] += buffer[i*channels + c];
+    }
+};
+
+class MovingAverageBlock : public BlockFilter {
+  public:
+    MovingAverageBlock(size_t size, size_t channels)
+      : BlockFilter(channels), size(size), mean(size, channels) {}
+
+    void process(Float *block, size_t frames) {
+      for (size_t f=0; f<frames; f++)
+        mean.push(block + f*channels);
+    }
+
+    void reset() { mean.reset(); }
+
+    size_t history() const { return size; }
+
+  protected:
+    size_t size;
+    RunningMean mean;
+};
+
+/* the mean plus its difference to the mean of the means */
+class DoubleMovingAverageBlock : public BlockFilter {
+  public:
+    DoubleMovingAverageBlock(size_t size, size_t channels)
+      : BlockFilter(channels), size(size), first(size, channels), second(size, channels), y(channels) {}
+
+    void process(Float *block, size_t frames) {
+      for (size_t f=0; f<frames; f++) {
+        Float *x = block + f*channels;
+        first.push(x);
+        std::copy(x, x + channels, y.begin());
+        second.push(&y[0]);
+        for (size_t c=0; c<channels; c++)
+          x[c] += x[c] - y[c];
+      }
+    }
+
+    void reset() { first.reset(); second.reset(); }
+
+    size_t history() const { return 2*size; }
+
+  protected:
+    size_t size;
+    RunningMean first, second;
+    vector<Float> y;
+};
+
+class LowPassBlock : public BlockFilter {
+  public:
+    LowPassBlock(Float factor, Float gain, size_t channels)
+      : BlockFilter(channels), factor(factor), gain(gain), y(channels, 0) {}
+
+    void process(Float *block, size_t frames) {
+      Float *yy = &y[0];
+      for (size_t f=0; f<frames; f++) {
+        Float *x = block + f*channels;
+        for (size_t c=0; c<channels; c++) {
+          yy[c] += factor * (x[c] - yy[c]);
+          x[c] = yy[c] * gain;
+        }
+      }
+    }
+
+    void reset() { std::fill(y.begin(), y.end(), 0); }
+
+  protected:
+    Float factor, gain;
+    vector<Float> y;
+};
+
+class HighPassBlock : public BlockFilter {
+  public:
+    HighPassBlock(Float factor, Float gain, size_t channels)
+      : BlockFilter(channels), factor(factor), gain(gain), x0(channels, 0), y(channels, 0) {}
+
+    void process(Float *block, size_t frames) {
+      Float *xx = &x0[0], *yy = &y[0];
+      for (size_t f=0; f<frames; f++) {
+        Float *x = block + f*channels;
+        for (size_t c=0; c<channels; c++) {
+          yy[c] = factor * (yy[c] + x[c] - xx[c]);
+          xx[c] = x[c];
+          x[c] = yy[c] * gain;
+        }
+      }
+    }
+
+    void reset() {
+      std::fill(x0.begin(), x0.end(), 0);
+      std::fill(y.begin(), y.end(), 0);
+    }
+
+  protected:
+    Float factor, gain;
+    vector<Float> x0, y;
+};
+
+class LeakyIntegratorBlock : public BlockFilter {
+  public:
+    LeakyIntegratorBlock(Float rate, size_t channels)
+      : BlockFilter(channels), rate(rate), y(channels, 0) {}
+
+    void process(Float *block, size_t frames) {
+      Float *yy = &y[0];
+      for (size_t f=0; f<frames; f++) {
+        Float *x = block + f*channels;
+        for (size_t c=0; c<channels; c++)
+          x[c] = yy[c] = yy[c] * rate + x[c];
+      }
+    }
+
+    void reset() { std::fill(y.begin(), y.end(), 0); }
+
+  protected:
+    Float rate;
+    vector<Float> y;
+};
+
+/* stateless, so the block is filtered as one run of values */
+class DeadZoneBlock : public BlockFilter {
+  public:
+    DeadZoneBlock(Float lower, Float upper, size_t channels)
+      : BlockFilter(channels), lower(lower), upper(upper) {}
+
+    void process(Float *block, size_t frames) {
+      for (size_t i=0, n=frames*channels; i<n; i++) {
+        Float x = block[i];
+        block[i] = x >= upper ? x - upper : x <= lower ? x - lower : 0;
+      }
+    }
+
+    void reset() {}
+
+  protected:
+    Float lower, upper;
+};
+
+/* first or second difference of the frames divided by delta, optionally of
+ * their running mean */
+class DerivativeBlock : public BlockFilter {
+  public:
+    DerivativeBlock(size_t order, Float delta, size_t filterSize, size_t channels)
+      : BlockFilter(channels), order(order), delta(delta), filterSize(filterSize),
+        mean(filterSize, channels), y1(channels, 0), y2(channels, 0) {}
+
+    void process(Float *block, size_t frames) {
+      Float *yy = &y1[0], *yyy = &y2[0];
+      for (size_t f=0; f<frames; f++) {
+        Float *x = block + f*channels;
+        if (filterSize > 0)
+          mean.push(x);
+
+        for (size_t c=0; c<channels; c++) {
+          Float d = (x[c] - yy[c]) / delta;
+          yy[c] = x[c];
+          x[c] = d;
+        }
+
+        if (order == 2)
+          for (size_t c=0; c<channels; c++) {
+            Float d = (x[c] - yyy[c]) / delta;
+            yyy[c] = x[c];
+            x[c] = d;
+          }
+      }
+    }
+
+    void reset() {
+      mean.reset();
+      std::fill(y1.begin(), y1.end(), 0);
+      std::fill(y2.begin(), y2.end(), 0);
+    }
+
+    size_t history() const { return filterSize + order; }
+
+  protected:
+    size_t order;
+    Float delta;
+    size_t filterSize;
+    RunningMean mean;
+    vector<Float> y1, y2;
+};
+
+/* Derivative has no getters for its settings, a member pointer reaches
+ * them like KnnIndex does for the training set of KNN */
+struct DerivativeSettings : Derivative {
+  static UINT order(Derivative *d)     { return d->*(&DerivativeSettings::derivativeOrder); }
+  static UINT size(Derivative *d)      { return d->*(&DerivativeSettings::filterSize); }
+  static bool filtering(Derivative *d) { return d->*(&DerivativeSettings::filterData); }
+  static Float step(Derivative *d)     { return d->*(&DerivativeSettings::delta); }
+};
+
+/* Convolution with few taps, y[t] = sum h[k] x[t-k], or with many while the
+ * blocks are too short for FftFirBlock to be faster. The last frames are
+ * kept twice in a row, so the taps always find them one after the other
+ * without wrapping around. */
+class FirBlock : public BlockFilter {
+  public:
+    static const size_t FFT_TAPS = 64;  // fewer taps are never worth an FFT
+
+    FirBlock(const vector<Float> &taps, size_t channels)
+      : BlockFilter(channels), h(taps), head(0), frames(2 * taps.size() * channels, 0), y(channels) {}
+
+    void process(Float *block, size_t n) {
+      size_t M = h.size();
+      for (size_t f=0; f<n; f++) {
+        Float *x = block + f*channels;
+        std::copy(x, x + channels, &frames[head * channels]);
+        std::copy(x, x + channels, &frames[(head + M) * channels]);
+
+        /* frames head+1 .. head+M, oldest first */
+        const Float *last = &frames[(head + M) * channels];
+        std::fill(y.begin(), y.end(), 0);
+        for (size_t k=0; k<M; k++) {
+          const Float *xk = last - k*channels;
+          Float hk = h[k];
+          for (size_t c=0; c<channels; c++)
+            y[c] += hk * xk[c];
+        }
+
+        std::copy(y.begin(), y.end(), x);
+        head = (head + 1) % M;
+      }
+    }
+
+    void reset() {
+      head = 0;
+      std::fill(frames.begin(), frames.end(), 0);
+    }
+
+    size_t history() const { return h.size(); }
+
+  protected:
+    vector<Float> h;
+    size_t head;
+    vector<Float> frames, y;
+};
+
+/* A radix-2 FFT of a fixed size on separate real and imaginary parts, with
+ * the bit reversal and the twiddle factors of each pass computed once. The
+ * plans are read-only and kept for each size, so filters of the same size
+ * share one. The inverse transform is not scaled. */
+class FftPlan {
+  public:
+    static shared_ptr<const FftPlan> of(size_t n) {
+      static mutex lock;
+      static map< size_t, shared_ptr<const FftPlan> > plans;
+
+      lock_guard<mutex> l(lock);
+      shared_ptr<const FftPlan> &plan = plans[n];
+      if (!plan)
+        plan.reset(new FftPlan(n));
+      return plan;
+    }
+
+    size_t size() const { return n; }
+
+    void transform(Float *re, Float *im, bool inverse = false) const {
+      for (size_t i=0; i<n; i++)
+        if (i < reversed[i]) {
+          std::swap(re[i], re[reversed[i]]);
+          std::swap(im[i], im[reversed[i]]);
+        }
+
+      Float sign = inverse ? -1 : 1;
+      for (size_t half=1; half<n; half*=2) {
+        const Float *wr = &cosines[half-1], *wi = &sines[half-1];
+        for (size_t start=0; start<n; start+=2*half) {
+          Float *ar = re + start, *ai = im + start, *br = ar + half, *bi = ai + half;
+          for (size_t j=0; j<half; j++) {
+            Float tr = br[j]*wr[j] + sign*bi[j]*wi[j],
+                  ti = bi[j]*wr[j] - sign*br[j]*wi[j];
+            br[j] = ar[j] - tr; bi[j] = ai[j] - ti;
+            ar[j] += tr;        ai[j] += ti;
+          }
+        }
+      }
+    }
+
+  protected:
+    size_t n;
+    vector<size_t> reversed;
+    vector<Float> cosines, sines;   // pass with half h starts at h-1
+
+    FftPlan(size_t n) : n(n), reversed(n, 0), cosines(n, 1), sines(n, 0) {
+      for (size_t i=1, j=0; i<n; i++) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+          j ^= bit;
+        j ^= bit;
+        reversed[i] = j;
+      }
+
+      for (size_t half=1; half<n; half*=2)
+        for (size_t j=0; j<half; j++) {
+          cosines[half-1+j] = cos(M_PI * j / half);
+          sines[half-1+j]   = sin(M_PI * j / half);
+        }
+    }
+};
+
+/* Convolution with many taps by overlap-save: the last M-1 frames and up to
+ * L = N-M+1 new ones are transformed, multiplied with the transform of the
+ * taps and transformed back, giving the output for the new frames. Since
+ * the taps are real, two channels go through one transform as its real
+ * and imaginary part. A block of fewer than L frames is filtered right
+ * away, so the size of the transform N is chosen for the expected number of
+ * frames per block, which sets the latency of the filter. */
+class FftFirBlock : public BlockFilter {
+  public:
+    FftFirBlock(const vector<Float> &taps, size_t channels, size_t block)
+      : BlockFilter(channels), M(taps.size()), past(channels * (taps.size() - 1), 0) {
+      plan = FftPlan::of(transformSize(M, block));
+      size_t N = plan->size();
+      L = N - M + 1;
+
+      hr.assign(N, 0); hi.assign(N, 0);
+      for (size_t k=0; k<M; k++)
+        hr[k] = taps[k] / N;
+      plan->transform(&hr[0], &hi[0]);
+      re.resize(N); im.resize(N);
+    }
+
+    /* The size with the least work per frame given the frames per block,
+     * and that work in multiply-adds per frame and channel, to compare with
+     * the number of taps of direct convolution. A butterfly on two channels
+     * costs about as much as two multiply-adds each, per pass. */
+    static size_t transformSize(size_t taps, size_t block, double *work = NULL) {
+      size_t best = 0;
+      double least = numeric_limits<double>::max();
+      for (size_t N = 2; N <= 64 * taps || best == 0; N *= 2) {
+        if (N < taps)
+          continue;
+        double w = 2 * N * log2(N) / std::min(N - taps + 1, std::max(block, (size_t) 1));
+        if (w < least) {
+          least = w;
+          best = N;
+        }
+      }
+      if (work)
+        *work = least;
+      return best;
+    }
+
+    void process(Float *block, size_t frames) {
+      for (size_t start=0; start<frames; start+=L) {
+        size_t k = std::min(L, frames - start);
+        for (size_t c=0; c<channels; c+=2)
+          filter(block + start*channels, k, c, c+1 < channels);
+      }
+    }
+
+    void reset() { std::fill(past.begin(), past.end(), 0); }
+
+    size_t history() const { return M; }
+
+  protected:
+    size_t M, L;
+    shared_ptr<const FftPlan> plan;
+    vector<Float> past, hr, hi, re, im;  // last M-1 frames of each channel, taps transformed
+
+    /* the k frames at x, for channel c and the next one if two */
+    void filter(Float *x, size_t k, size_t c, bool two) {
+      size_t N = plan->size();
+      Float *pr = &past[c * (M-1)], *pi = two ? pr + (M-1) : NULL;
+
+      std::copy(pr, pr + M-1, re.begin());
+      std::fill(re.begin() + M-1 + k, re.end(), 0);
+      std::fill(im.begin(), im.end(), 0);
+      if (two)
+        std::copy(pi, pi + M-1, im.begin());
+      for (size_t f=0; f<k; f++) {
+        re[M-1+f] = x[f*channels + c];
+        if (two)
+          im[M-1+f] = x[f*channels + c+1];
+      }
+
+      /* the last M-1 frames are those before the next block */
+      std::copy(re.begin() + k, re.begin() + k + M-1, pr);
+      if (two)
+        std::copy(im.begin() + k, im.begin() + k + M-1, pi);
+
+      plan->transform(&re[0], &im[0]);
+      for (size_t i=0; i<N; i++) {
+        Float r = re[i]*hr[i] - im[i]*hi[i];
+        im[i]   = re[i]*hi[i] + im[i]*hr[i];
+        re[i]   = r;
+      }
+      plan->transform(&re[0], &im[0], true);
+
+      for (size_t f=0; f<k; f++) {
+        x[f*channels + c] = re[M-1+f];
+        if (two)
+          x[f*channels + c+1] = im[M-1+f];
+      }
+    }
+};
+
+/* Rational resampling by up/down, e.g. 800 Hz to 50 Hz with up=1 and
+ * down=16. The frames are upsampled by inserting up-1 zeros after each,
+ * low-pass filtered below the lower of both Nyquist frequencies, and every
+ * down-th value is kept. Only the kept values are computed: output n sums
+ * every up-th tap of the filter, one of up polyphase filters, against the
+ * input frames. The filter is a Blackman-windowed sinc with zeros zero
+ * crossings on either side, centred on the output, so output n lies at
+ * input frame n*down/up. It is therefore only complete once the frames
+ * after it have been read, and at the end of the input the frames that are
+ * missing are taken to be zero.
+ *
+ * Each output frame is labelled like the input frame nearest to it, or
+ * with the label most of the input frames within half an output period
+ * have, the nearest one winning a tie. */
+class Resampler {
+  public:
+    Resampler(size_t up, size_t down, size_t zeros, bool majority)
+      : majority(majority), channels(0) {
+      size_t g = gcd(up, down);
+      this->up = up / g;
+      this->down = down / g;
+
+      /* taps at the upsampled rate, summing up to up so the gain is one */
+      size_t wide = std::max(this->up, this->down), K = 2 * zeros * wide + 1;
+      double sum = 0;
+      center = (K - 1) / 2;
+      h.resize(K);
+      for (size_t k=0; k<K; k++) {
+        double x = ((double) k - center) / wide,
+               w = .42 - .5 * cos(2*M_PI*k / (K-1)) + .08 * cos(4*M_PI*k / (K-1));
+        h[k] = w * (x == 0 ? 1 : sin(M_PI*x) / (M_PI*x));
+        sum += h[k];
+      }
+      for (auto &v : h)
+        v *= this->up / sum;
+
+      phases.resize(this->up);
+      for (size_t k=0; k<K; k++)
+        phases[k % this->up].push_back(h[k]);
+
+      reset();
+    }
+
+    void init(size_t channels) {
+      this->channels = channels;
+      y.resize(channels);
+      reset();
+    }
+
+    void reset() {
+      frames.clear();
+      labels.clear();
+      first = seen = next = 0;
+    }
+
+    /* Adds a frame and calls out(frame, label) for each output frame that
+     * has been completed by it. */
+    template<class Out> void push(const Float *x, const string &label, Out out) {
+      frames.insert(frames.end(), x, x + channels);
+      labels.push_back(label);
+      seen++;
+
+      /* output n needs the frames up to (n*down + center) / up */
+      while ((next*down + center) / up < seen)
+        emit(out);
+      drop();
+    }
+
+    /* completes the output frames of the input read so far */
+    template<class Out> void flush(Out out) {
+      while (seen > 0 && next*down < seen*up)
+        emit(out);
+    }
+
+  protected:
+    size_t up, down, center;
+    bool majority;
+    size_t channels;
+    vector<Float> h, y;
+    vector< vector<Float> > phases;   // phases[p][j] is h[p + j*up]
+    vector<Float> frames;             // input frames from first on
+    deque<string> labels;
+    size_t first, seen, next;         // first frame kept, frames read, next output
+
+    static size_t gcd(size_t a, size_t b) { return b == 0 ? a : gcd(b, a % b); }
+
+    template<class Out> void emit(Out out) {
+      size_t u = next*down + center, p = u % up, i0 = u / up;
+      const vector<Float> &taps = phases[p];
+
+      std::fill(y.begin(), y.end(), 0);
+      for (size_t j=0; j<taps.size() && j<=i0; j++) {
+        size_t i = i0 - j;
+        if (i >= seen)
+          continue;
+        const Float *x = &frames[(i - first) * channels];
+        Float t = taps[j];
+        for (size_t c=0; c<channels; c++)
+          y[c] += t * x[c];
+      }
+
+      out(&y[0], labels[label(next) - first]);
+      next++;
+    }
+
+    /* the input frame whose label output n gets */
+    size_t label(size_t n) const {
+      size_t last = seen - 1, nearest = std::min((2*n*down + up) / (2*up), last);
+      if (!majority)
+        return nearest;
+
+      /* frames i with |i*up - n*down| <= down/2, all of which have been read
+       * unless at the end */
+      size_t lo = n*down >= down/2 ? (n*down - down/2 + up - 1) / up : 0,
+             hi = std::min((n*down + down/2) / up, last), best = nearest, most = 0;
+      lo = std::max(lo, first);
+      for (size_t i=lo; i<=hi; i++) {
+        size_t count = 0;
+        for (size_t j=lo; j<=hi; j++)
+          count += labels[j - first] == labels[i - first];
+        size_t d = i > nearest ? i - nearest : nearest - i,
+               dbest = best > nearest ? best - nearest : nearest - best;
+        if (count > most || (count == most && d < dbest)) {
+          most = count;
+          best = i;
+        }
+      }
+      return best;
+    }
+
+    /* forgets the frames no output needs anymore */
+    void drop() {
+      size_t u = next*down + center, oldest = u >= h.size() - 1 ? (u - (h.size() - 1)) / up : 0,
+             lo = next*down >= down/2 ? (next*down - down/2) / up : 0;
+      oldest = std::min(std::min(oldest, lo), seen - 1);
+      if (oldest >= first + 1024) {
+        frames.erase(frames.begin(), frames.begin() + (oldest - first) * channels);
+        labels.erase(labels.begin(), labels.begin() + (oldest - first));
+        first = oldest;
+      }
+    }
+};
+
+/* The taps of a FIRFilter, read off its response to an impulse, after
+ * which it is reset. This includes the gain, and does not depend on how
+ * GRT designs the filter. */
+static vector<Float> impulseResponse(FIRFilter *fir, size_t channels)
+{
+  vector<Float> taps;
+  VectorFloat x(channels, 0);
+
+  x[0] = 1;
+  for (size_t t=0; t<fir->getNumTaps(); t++) {
+    if (!fir->process(x) || fir->getProcessedData().size() != channels)
+      return vector<Float>();
+    taps.push_back(fir->getProcessedData()[0]);
+    x[0] = 0;
+  }
+
+  fir->reset();
+  return taps;
+}
+
+/* returns NULL for pre-processors that are only run by GRT, or for all of
+ * them if $GRT_COMPILED is 0, e.g. to compare both. block is the number of
+ * frames that will usually be filtered at once. */
+static BlockFilter *compileFilter(PreProcessing *pp, size_t channels, size_t block = 1)
+{
+  const char *env = getenv("GRT_COMPILED");
+  if (channels == 0 || (env && strcmp(env, "0") == 0))
+    return NULL;
+
+  if (auto *f = dynamic_cast<FIRFilter*>(pp)) {
+    vector<Float> taps = impulseResponse(f, channels);
+    if (taps.empty())
+      return NULL;
+    double work = 0;
+    if (taps.size() > FirBlock::FFT_TAPS &&
+        FftFirBlock::transformSize(taps.size(), block, &work) && work < taps.size())
+      return new FftFirBlock(taps, channels, block);
+    return new FirBlock(taps, channels);
+  }
+
+  if (auto *m = dynamic_cast<MovingAverageFilter*>(pp))
+    return new MovingAverageBlock(m->getFilterSize(), channels);
+  if (auto *m = dynamic_cast<DoubleMovingAverageFilter*>(pp))
+    return new DoubleMovingAverageBlock(m->getFilterSize(), channels);
+  if (auto *l = dynamic_cast<LowPassFilter*>(pp))
+    return new LowPassBlock(l->getFilterFactor(), l->getGain(), channels);
+  if (auto *h = dynamic_cast<HighPassFilter*>(pp))
+    return new HighPassBlock(h->getFilterFactor(), h->getGain(), channels);
+  if (auto *l = dynamic_cast<LeakyIntegrator*>(pp))
+    return new LeakyIntegratorBlock(l->getLeakRate(), channels);
+  if (auto *d = dynamic_cast<DeadZone*>(pp))
+    return new DeadZoneBlock(d->getLowerLimit(), d->getUpperLimit(), channels);
+
+  if (auto *d = dynamic_cast<Derivative*>(pp)) {
+    UINT order = DerivativeSettings::order(d);
+    Float delta = DerivativeSettings::step(d);
+    if ((order != 1 && order != 2) || delta == 0)
+      return NULL;
+    return new DerivativeBlock(order, delta,
+      DerivativeSettings::filtering(d) ? DerivativeSettings::size(d) : 0, channels);
+  }
+
+  return NULL;
+}
+
+#endif
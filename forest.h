@@ -0,0 +1,281 @@
+#ifndef _FOREST_H_
+#define _FOREST_H_
+
+#include "compiled.h"
+#include <cstdint>
+#include <limits>
+
+/* DecisionTree and RandomForests models compiled for prediction. Each tree
+ * is an array of nodes in breadth-first order, so that the two children of
+ * a node are next to each other and the path is computed instead of
+ * branched on:
+ *
+ *   node = nodes[node].next + (x[nodes[node].feature] >= nodes[node].threshold)
+ *
+ * Leaves point to themselves with a threshold that never compares true, so
+ * a block of samples walks a tree for its full depth in lock-step. Trees
+ * are evaluated in the same order as GRT does, and the class likelihoods
+ * are summed up in the same order, which gives the same predictions and
+ * likelihoods. Models with null rejection or nodes other than cluster and
+ * threshold nodes are not compiled and predicted by GRT.
+ *
+ * The nodes and leaves of all trees are kept in one array each, which binary
+ * models store in sections and predict from in place. */
+class FlatForest : public CompiledModel {
+  public:
+    /* returns NULL if the classifier can not be compiled */
+    static FlatForest *compile(Classifier *classifier) {
+      vector<const DecisionTreeNode*> roots;
+      FlatForest *f = create(classifier, &roots);
+      vector<Tree>  trees;
+      vector<Node>  nodes;
+      vector<Float> leaves;
+
+      if (f == NULL)
+        return NULL;
+
+      for (auto *root : roots)
+        if (root == NULL || !f->add(root, trees, nodes, leaves)) {
+          delete f;
+          return NULL;
+        }
+
+      f->trees.assign(trees);
+      f->nodes.assign(nodes);
+      f->leaves.assign(leaves);
+      return f;
+    }
+
+    /* Opens the trees stored with a binary model of the classifier, returns
+     * NULL if there are none or they do not fit it. The trees are checked
+     * to stay within their arrays, but not walked. */
+    static FlatForest *open(const BinaryModel &model, Classifier *classifier) {
+      Params p;
+      FlatForest *f = model.get("forest", p) ? create(classifier, NULL) : NULL;
+
+      if (f == NULL)
+        return NULL;
+
+      if (p.dims != f->dims || p.classes != f->labels.size() || p.floatsize != sizeof(Float) ||
+          !f->trees.view(model, "forest.trees") || !f->nodes.view(model, "forest.nodes") ||
+          !f->leaves.view(model, "forest.leaves") || f->trees.empty() || !f->valid()) {
+        delete f;
+        return NULL;
+      }
+
+      return f;
+    }
+
+    bool save(BinaryModelWriter &model) const {
+      Params p = { (uint32_t) dims, (uint32_t) labels.size(), sizeof(Float), 0 };
+      model.put("forest", p);
+      trees.save(model, "forest.trees");
+      nodes.save(model, "forest.nodes");
+      leaves.save(model, "forest.leaves");
+      return true;
+    }
+
+    size_t size() const { return trees.size(); }
+
+    /* the trees are walked by blocks of samples, so each tree is loaded
+     * once per block */
+    bool predict(VectorFloat *const *x, size_t n, UINT *predicted, Float *likelihood) const {
+      const size_t K = labels.size();
+      uint32_t index[BLOCK];
+      vector<Float> scaled(BLOCK * dims), sums(BLOCK * K);
+
+      for (size_t i=0; i<n; i++)
+        if (x[i]->size() != dims)
+          return false;
+
+      for (size_t b=0; b<n; b+=BLOCK) {
+        size_t m = std::min(n-b, (size_t) BLOCK);
+
+        /* scale to [0,1] with the same arithmetic as GRT, i.e. unclipped */
+        for (size_t i=0; i<m; i++)
+          for (size_t j=0; j<dims; j++) {
+            Float v = (*x[b+i])[j];
+            if (scaling)
+              v = ranges[j].minValue == ranges[j].maxValue ? 0 :
+                  (v - ranges[j].minValue) / (ranges[j].maxValue - ranges[j].minValue);
+            scaled[i*dims + j] = v;
+          }
+
+        fill(sums.begin(), sums.begin() + m*K, 0.);
+
+        for (size_t k=0; k<trees.size(); k++) {
+          const Tree &t = trees[k];
+          const Node *nodes = &this->nodes[t.nodes];
+
+          for (size_t i=0; i<m; i++)
+            index[i] = 0;
+
+          for (uint32_t d=0; d<t.depth; d++)
+            for (size_t i=0; i<m; i++) {
+              const Node &node = nodes[index[i]];
+              index[i] = node.next + (scaled[i*dims + node.feature] >= node.threshold);
+            }
+
+          for (size_t i=0; i<m; i++) {
+            const Float *values = &leaves[t.leaves + nodes[index[i]].leaf * K];
+            for (size_t k=0; k<K; k++)
+              sums[i*K + k] += values[k];
+          }
+        }
+
+        /* first class with the largest likelihood, like in GRT */
+        Float norm = 1.0 / Float(trees.size());
+        for (size_t i=0; i<m; i++) {
+          Float best = 0;
+          size_t bestIndex = 0;
+          for (size_t k=0; k<K; k++) {
+            Float v = average ? sums[i*K + k] * norm : sums[i*K + k];
+            if (v > best) {
+              best = v;
+              bestIndex = k;
+            }
+          }
+          predicted[b+i]  = labels[bestIndex];
+          likelihood[b+i] = best;
+        }
+      }
+
+      return true;
+    }
+
+  protected:
+    static const size_t BLOCK = 64;
+
+    /* node indices are relative to the first node of their tree, and so
+     * are leaf indices to its first leaf */
+    struct Node {
+      Float    threshold;
+      uint32_t feature, next, leaf, reserved;
+    };
+
+    /* first node and first class probability of each tree */
+    struct Tree {
+      uint64_t nodes, leaves;
+      uint32_t count, depth;
+    };
+
+    struct Params {
+      uint32_t dims, classes, floatsize, reserved;
+    };
+
+    size_t dims;
+    bool average, scaling;
+    vector<UINT> labels;
+    vector<MinMax> ranges;
+    ModelArray<Tree>  trees;
+    ModelArray<Node>  nodes;
+    ModelArray<Float> leaves;  // class probabilities of each leaf
+
+    /* everything but the trees, which are added to roots if given */
+    static FlatForest *create(Classifier *classifier, vector<const DecisionTreeNode*> *roots) {
+      RandomForests *rf = dynamic_cast<RandomForests*>(classifier);
+      DecisionTree  *dt = dynamic_cast<DecisionTree*>(classifier);
+
+      if ((rf == NULL && dt == NULL) || !classifier->getTrained() ||
+          classifier->getNullRejectionEnabled())
+        return NULL;
+
+      if (roots != NULL && rf != NULL)
+        for (auto *tree : rf->getForest())
+          roots->push_back(tree);
+      else if (roots != NULL)
+        roots->push_back(dt->getTree());
+
+      FlatForest *f = new FlatForest;
+      f->dims    = classifier->getNumInputDimensions();
+      f->labels  = classifier->getClassLabels();
+      f->average = rf != NULL;
+      f->scaling = classifier->getScalingEnabled();
+      f->ranges  = classifier->getRanges();
+
+      if (f->labels.size() == 0 || (f->scaling && f->ranges.size() != f->dims)) {
+        delete f;
+        return NULL;
+      }
+
+      return f;
+    }
+
+    /* every path stays within its tree and ends in a leaf of the tree */
+    bool valid() const {
+      const size_t K = labels.size();
+
+      for (size_t k=0; k<trees.size(); k++) {
+        const Tree &t = trees[k];
+        if (t.count == 0 || t.nodes > nodes.size() || t.count > nodes.size() - t.nodes ||
+            t.leaves > leaves.size() || t.depth > t.count)
+          return false;
+
+        for (uint32_t i=0; i<t.count; i++) {
+          const Node &node = nodes[t.nodes + i];
+          bool leaf = node.next == i;
+          if ((!leaf && (node.next <= i || node.next >= t.count - 1)) || node.feature >= dims ||
+              node.leaf >= (leaves.size() - t.leaves) / K)
+            return false;
+        }
+      }
+
+      return true;
+    }
+
+    /* lays out a tree breadth-first, children are enqueued pairwise */
+    bool add(const DecisionTreeNode *root, vector<Tree> &trees, vector<Node> &nodes, vector<Float> &leaves) {
+      Tree t;
+      vector< pair<const DecisionTreeNode*, uint32_t> > queue(1, make_pair(root, 0u));
+      t.nodes  = nodes.size();
+      t.leaves = leaves.size();
+      t.depth  = 0;
+
+      for (size_t i=0; i<queue.size(); i++) {
+        const DecisionTreeNode *node = queue[i].first;
+        uint32_t depth = queue[i].second;
+        Node flat;
+        memset(&flat, 0, sizeof(flat));
+
+        if (node->getIsLeafNode()) {
+          VectorFloat p = node->getClassProbabilities();
+          if (p.size() != labels.size())
+            return false;
+
+          flat.threshold = numeric_limits<Float>::quiet_NaN();
+          flat.feature   = 0;
+          flat.next      = i;
+          flat.leaf      = (leaves.size() - t.leaves) / labels.size();
+          leaves.insert(leaves.end(), p.begin(), p.end());
+          t.depth = std::max(t.depth, depth);
+        } else {
+          const DecisionTreeNode *left  = dynamic_cast<const DecisionTreeNode*>(node->getLeftChild()),
+                                 *right = dynamic_cast<const DecisionTreeNode*>(node->getRightChild());
+          const DecisionTreeClusterNode   *cluster   = dynamic_cast<const DecisionTreeClusterNode*>(node);
+          const DecisionTreeThresholdNode *threshold = dynamic_cast<const DecisionTreeThresholdNode*>(node);
+
+          if (left == NULL || right == NULL || (cluster == NULL && threshold == NULL))
+            return false;
+
+          flat.feature   = cluster ? cluster->getFeatureIndex() : threshold->getFeatureIndex();
+          flat.threshold = cluster ? cluster->getThreshold()    : threshold->getThreshold();
+          flat.next      = queue.size();
+          flat.leaf      = 0;
+
+          if (flat.feature >= dims)
+            return false;
+
+          queue.push_back(make_pair(left,  depth+1));
+          queue.push_back(make_pair(right, depth+1));
+        }
+
+        nodes.push_back(flat);
+      }
+
+      t.count = queue.size();
+      trees.push_back(t);
+      return true;
+    }
+};
+
+#endif
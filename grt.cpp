@@ -7,10 +7,12 @@
 vector<vector<const char*>> cmds = {
   {"help",        "h",   "prints this message or the help for the specified command"},
   {"info",        "i",   "print stats about a dataset file"},
+  {"convert",     "c",   "convert a dataset between text and binary format"},
   {"train",       "t",   "trains a prediction model"},
   {"train-dlib",  "td",  "trains a prediction model, uses dlib multiclass machine learning trainers"},
   {"predict",     "p",   "predict from unseen data"},
   {"predict-dlib","pd",  "predict from unseen data, processes trainers created from train-dlib"},
+  {"serve",       "sv",  "keep prediction models loaded for grt predict --connect"},
   {"score",       "s",   "calculate classifcation score for prediction"},
   {"extract",     "e",   "extract features from a data sequence"},
   {"preprocess",  "pp",  "preprocess data sequence"},
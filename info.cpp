@@ -5,6 +5,7 @@ int main(int argc, char *argv[])
 {
   cmdline::parser c;
   c.add<string>("type",       't', "force input type", false, "classification", cmdline::oneof<string>("classification", "regression", "timeseries", "auto"));
+  c.add<int>   ("threads",    'j', "number of threads for parsing the input, 0 uses all cores", false, 0);
   c.add<int>   ("verbose",    'v', "verbosity level: 0-4", false, 0);
   c.add        ("help",       'h', "print this message");
   c.footer     ("[filename]...");
@@ -24,15 +25,17 @@ int main(int argc, char *argv[])
   set_verbosity(c.get<int>("verbose"));
 
   /* load the dataset and print its stats */
-  istream &in = grt_fileinput(c);
+  LineReader &in = grt_lineinput(c);
   if (!in) return -1;
 
   string type = c.get<string>("type");
   CsvIOSample io(type);
   CollectDataset dataset;
 
-  while (in >> io)
-    csvio_dispatch(io, dataset.add, io.labelset);
+  if (!dataset.read(in, io, c.get<int>("threads")) && io.errline != 0) {
+    cerr << "error at line " << io.errline << ": number of dimensions changed" << endl;
+    return -1;
+  }
 
   cout << dataset.getStatsAsString();
   return 0;
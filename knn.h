@@ -0,0 +1,484 @@
+#ifndef _KNN_H_
+#define _KNN_H_
+
+#include "compiled.h"
+#include <cmath>
+#include <limits>
+
+/* KNN models compiled for prediction. GRT compares every sample with the
+ * whole training set, one training sample at a time. Here the training set
+ * is laid out in blocks of LANES samples, dimension by dimension, so that
+ * the distances to a block are computed together with vector instructions,
+ * and a batch of samples is compared with each block while it is in cache.
+ *
+ * For euclidean and manhattan distance in few dimensions, a KD-tree finds
+ * the nearest neighbours without looking at most of the training set. The
+ * distances are computed exactly like GRT does, so the neighbours found are
+ * the same unless several training samples are as far as the K-th nearest
+ * one. GRT then keeps a set of them that depends on the order of training
+ * samples, and the sample is predicted by going through the whole training
+ * set in GRT's order. The same is done when null rejection depends on the
+ * order in which the distances of the neighbours are added up.
+ *
+ * Binary models store the blocks and the tree, which are predicted from in
+ * place instead of being built again when the model is loaded. */
+class KnnIndex : public CompiledModel {
+  public:
+    /* returns NULL if the classifier can not be compiled */
+    static KnnIndex *compile(Classifier *classifier) {
+      KnnIndex *k = create(classifier);
+
+      if (k == NULL)
+        return NULL;
+
+      ClassificationData &data = KNNTrainingData::of(dynamic_cast<KNN*>(classifier));
+      k->n = data.getNumSamples();
+
+      bool ok = k->n > 0 && k->n < numeric_limits<uint32_t>::max();
+      for (size_t i=0; ok && i<k->n; i++) {
+        ClassificationSample &s = data[i];
+        ok = s.getClassLabel() >= 1 && s.getClassLabel() <= k->labels.size() &&
+             s.getNumDimensions() == k->dims;
+      }
+
+      if (!ok) {
+        delete k;
+        return NULL;
+      }
+
+      k->build(data);
+      return k;
+    }
+
+    /* Opens the index stored with a binary model of the classifier, returns
+     * NULL if there is none or it does not fit it. */
+    static KnnIndex *open(const BinaryModel &model, Classifier *classifier) {
+      Params p;
+      KnnIndex *k = model.get("knn.index", p) ? create(classifier) : NULL;
+
+      if (k == NULL)
+        return NULL;
+
+      k->n = p.n;
+      if (p.dims != k->dims || p.K != k->K || p.distance != k->distance || p.lanes != LANES ||
+          p.floatsize != sizeof(Float) || p.n == 0 || p.n >= numeric_limits<uint32_t>::max() ||
+          !k->targets.view(model, "knn.targets") || !k->blocks.view(model, "knn.blocks") ||
+          !k->norms.view(model, "knn.norms") || !k->tree.view(model, "knn.tree") ||
+          !k->points.view(model, "knn.points") || !k->ids.view(model, "knn.ids") || !k->valid()) {
+        delete k;
+        return NULL;
+      }
+
+      return k;
+    }
+
+    bool save(BinaryModelWriter &model) const {
+      Params p = { (uint32_t) dims, (uint32_t) K, distance, LANES, sizeof(Float), 0, n };
+      model.put("knn.index", p);
+      targets.save(model, "knn.targets");
+      blocks.save(model, "knn.blocks");
+      norms.save(model, "knn.norms");
+      tree.save(model, "knn.tree");
+      points.save(model, "knn.points");
+      ids.save(model, "knn.ids");
+      return true;
+    }
+
+    bool predict(VectorFloat *const *x, size_t n, UINT *predicted, Float *likelihood) const {
+      vector<Float> q(QUERIES * dims);
+
+      for (size_t i=0; i<n; i++)
+        if (x[i]->size() != dims)
+          return false;
+
+      for (size_t b=0; b<n; b+=QUERIES) {
+        size_t m = std::min(n-b, (size_t) QUERIES);
+        vector<size_t> scan;
+
+        for (size_t i=0; i<m; i++)
+          for (size_t j=0; j<dims; j++) {
+            Float v = (*x[b+i])[j];
+            if (scaling)
+              v = ranges[j].minValue == ranges[j].maxValue ? 0 :
+                  (v - ranges[j].minValue) / (ranges[j].maxValue - ranges[j].minValue);
+            q[i*dims + j] = v;
+          }
+
+        for (size_t i=0; i<m; i++)
+          if (!tree.empty() && all_finite(&q[i*dims])) {
+            Candidates c(K);
+            search(0, &q[i*dims], c);
+            if (c.exact() && decide(c.heap, false, predicted[b+i], likelihood[b+i]))
+              continue;
+            scan.push_back(i);
+          } else
+            scan.push_back(i);
+
+        if (scan.empty())
+          continue;
+
+        vector<Neighbours> nb(scan.size(), Neighbours(K));
+        vector<Float> qs;
+        for (size_t i : scan)
+          qs.insert(qs.end(), q.begin() + i*dims, q.begin() + (i+1)*dims);
+
+        brute_force(&qs[0], scan.size(), &nb[0]);
+
+        for (size_t i=0; i<scan.size(); i++)
+          decide(nb[i].buf, true, predicted[b+scan[i]], likelihood[b+scan[i]]);
+      }
+
+      return true;
+    }
+
+  protected:
+    static const size_t LANES = 8, QUERIES = 16, LEAF = 16, TREE_DIMS = 12;
+
+    typedef pair<Float, uint32_t> Neighbour;  // distance and training sample
+
+    /* the neighbour buffer of GRT: the first K samples are taken, after that
+     * a sample replaces the first of the farthest if it is nearer */
+    struct Neighbours {
+      vector<Neighbour> buf;
+      size_t K, far;
+
+      Neighbours(size_t K) : K(K), far(0) {}
+
+      void offer(Float dist, uint32_t i) {
+        if (buf.size() < K) {
+          buf.push_back(Neighbour(dist, i));
+          if (buf.size() == K)
+            farthest();
+        } else if (dist < buf[far].first) {
+          buf[far] = Neighbour(dist, i);
+          farthest();
+        }
+      }
+
+      void farthest() {
+        far = 0;
+        for (size_t i=1; i<buf.size(); i++)
+          if (buf[i].first > buf[far].first)
+            far = i;
+      }
+    };
+
+    /* the K nearest samples found by the tree, and the nearest of those
+     * that were looked at but not taken */
+    struct Candidates {
+      vector<Neighbour> heap;
+      size_t K;
+      Float rejected;
+
+      Candidates(size_t K) : K(K), rejected(numeric_limits<Float>::infinity()) {}
+
+      /* distances rounded differently are still looked at */
+      Float bound() const {
+        return heap.size() < K ? numeric_limits<Float>::infinity() : heap.front().first * (1 + 1e-9);
+      }
+
+      void offer(Float dist, uint32_t i) {
+        if (heap.size() < K) {
+          heap.push_back(Neighbour(dist, i));
+          push_heap(heap.begin(), heap.end());
+        } else if (dist < heap.front().first) {
+          rejected = std::min(rejected, heap.front().first);
+          pop_heap(heap.begin(), heap.end());
+          heap.back() = Neighbour(dist, i);
+          push_heap(heap.begin(), heap.end());
+        } else
+          rejected = std::min(rejected, dist);
+      }
+
+      /* false if GRT might have chosen others of equal distance */
+      bool exact() const { return heap.size() < K || rejected > heap.front().first; }
+    };
+
+    struct Node {
+      uint32_t begin, end;  // samples of a leaf
+      uint32_t feature, reserved;
+      Float    split;
+      int32_t  left, right; // -1 for leaves
+    };
+
+    struct Params {
+      uint32_t dims, K, distance, lanes, floatsize, reserved;
+      uint64_t n;
+    };
+
+    size_t dims, n, K;
+    UINT distance;
+    bool scaling, rejection;
+    vector<UINT> labels;
+    vector<MinMax> ranges;
+    VectorFloat thresholds;
+
+    ModelArray<uint32_t> targets; // class index of each training sample
+    ModelArray<Float> blocks;     // training set by blocks of LANES samples, dimension-major
+    ModelArray<Float> norms;      // length of each training sample, for cosine distance
+    ModelArray<Node> tree;
+    ModelArray<Float> points;     // training set in the order of the tree leaves
+    ModelArray<uint32_t> ids;     // index of each of these in the training set
+
+    /* everything but the training set */
+    static KnnIndex *create(Classifier *classifier) {
+      KNN *knn = dynamic_cast<KNN*>(classifier);
+
+      if (knn == NULL || !knn->getTrained() || knn->getK() == 0 ||
+          knn->getNumInputDimensions() == 0)
+        return NULL;
+
+      KnnIndex *k = new KnnIndex;
+      k->dims      = knn->getNumInputDimensions();
+      k->n         = 0;
+      k->K         = knn->getK();
+      k->distance  = knn->getDistanceMethod();
+      k->labels    = knn->getClassLabels();
+      k->scaling   = knn->getScalingEnabled();
+      k->ranges    = knn->getRanges();
+      k->rejection = knn->getNullRejectionEnabled();
+      k->thresholds = knn->getNullRejectionThresholds();
+
+      /* GRT counts the neighbours of label l at index l-1 */
+      bool ok = (k->distance == KNN::EUCLIDEAN_DISTANCE || k->distance == KNN::COSINE_DISTANCE ||
+                 k->distance == KNN::MANHATTAN_DISTANCE) &&
+                (!k->scaling || k->ranges.size() == k->dims) &&
+                (!k->rejection || k->thresholds.size() == k->labels.size());
+      for (size_t i=0; i<k->labels.size(); i++)
+        ok = ok && k->labels[i] == i+1;
+
+      if (!ok) {
+        delete k;
+        return NULL;
+      }
+
+      return k;
+    }
+
+    /* the arrays of a stored index have the sizes build gives them, and
+     * the tree only refers to samples and nodes that exist */
+    bool valid() const {
+      size_t nblocks = (n + LANES - 1) / LANES;
+
+      if (targets.size() != n || blocks.size() != nblocks * LANES * dims ||
+          norms.size() != nblocks * LANES)
+        return false;
+      for (size_t i=0; i<n; i++)
+        if (targets[i] >= labels.size())
+          return false;
+
+      if (tree.empty())
+        return points.empty() && ids.empty();
+      if (points.size() != n * dims || ids.size() != n || tree.size() >= (size_t) numeric_limits<int32_t>::max())
+        return false;
+      for (size_t i=0; i<n; i++)
+        if (ids[i] >= n)
+          return false;
+
+      /* children come after their parent, so the search ends */
+      for (size_t i=0; i<tree.size(); i++) {
+        const Node &node = tree[i];
+        if (node.begin > node.end || node.end > n || node.feature >= dims ||
+            (node.left < 0) != (node.right < 0) ||
+            (node.left >= 0 && ((size_t) node.left <= i || (size_t) node.left >= tree.size() ||
+                                (size_t) node.right <= i || (size_t) node.right >= tree.size())))
+          return false;
+      }
+
+      return true;
+    }
+
+    void build(ClassificationData &data) {
+      size_t nblocks = (n + LANES - 1) / LANES;
+      bool finite_data = true;
+      vector<uint32_t> targets(n);
+      vector<Float> blocks(nblocks * LANES * dims, 0), norms(nblocks * LANES, 0);
+
+      for (size_t i=0; i<n; i++) {
+        VectorFloat &s = data[i].getSample();
+        Float mag = 0;
+        targets[i] = data[i].getClassLabel() - 1;
+        for (size_t j=0; j<dims; j++) {
+          blocks[(i/LANES)*LANES*dims + j*LANES + i%LANES] = s[j];
+          mag += s[j] * s[j];
+          finite_data = finite_data && std::isfinite(s[j]);
+        }
+        norms[i] = sqrt(mag);
+      }
+
+      this->targets.assign(targets);
+      this->blocks.assign(blocks);
+      this->norms.assign(norms);
+
+      if (distance == KNN::COSINE_DISTANCE || dims > TREE_DIMS || !finite_data || n <= LEAF)
+        return;
+
+      vector<uint32_t> order(n);
+      vector<Node> tree;
+      for (size_t i=0; i<n; i++)
+        order[i] = i;
+      split(data, order, tree, 0, n);
+
+      vector<Float> points(n * dims);
+      for (size_t i=0; i<n; i++)
+        for (size_t j=0; j<dims; j++)
+          points[i*dims + j] = data[order[i]].getSample()[j];
+
+      this->tree.assign(tree);
+      this->points.assign(points);
+      this->ids.assign(order);
+    }
+
+    /* splits at the median of the dimension with the largest spread */
+    int32_t split(ClassificationData &data, vector<uint32_t> &order, vector<Node> &tree,
+                  size_t begin, size_t end) {
+      Node node = { (uint32_t) begin, (uint32_t) end, 0, 0, 0, -1, -1 };
+      int32_t index = tree.size();
+      tree.push_back(node);
+
+      if (end - begin <= LEAF)
+        return index;
+
+      Float spread = -1;
+      for (size_t j=0; j<dims; j++) {
+        Float lo = numeric_limits<Float>::infinity(), hi = -lo;
+        for (size_t i=begin; i<end; i++) {
+          Float v = data[order[i]].getSample()[j];
+          lo = std::min(lo, v);
+          hi = std::max(hi, v);
+        }
+        if (hi - lo > spread) {
+          spread = hi - lo;
+          node.feature = j;
+        }
+      }
+
+      size_t mid = begin + (end - begin) / 2;
+      nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+        [&](uint32_t a, uint32_t b) {
+          return data[a].getSample()[node.feature] < data[b].getSample()[node.feature];
+        });
+
+      node.split = data[order[mid]].getSample()[node.feature];
+      node.left  = split(data, order, tree, begin, mid);
+      node.right = split(data, order, tree, mid, end);
+      tree[index] = node;
+      return index;
+    }
+
+    bool all_finite(const Float *q) const {
+      for (size_t j=0; j<dims; j++)
+        if (!std::isfinite(q[j]))
+          return false;
+      return true;
+    }
+
+    /* distance between a sample and a training sample, added up like GRT */
+    Float dist(const Float *q, const Float *p) const {
+      Float d = 0;
+      if (distance == KNN::EUCLIDEAN_DISTANCE) {
+        for (size_t j=0; j<dims; j++)
+          d += (q[j] - p[j]) * (q[j] - p[j]);
+        return sqrt(d);
+      }
+      for (size_t j=0; j<dims; j++)
+        d += fabs(q[j] - p[j]);
+      return d;
+    }
+
+    /* Every training sample lies on the far side of a split by at least the
+     * distance of the sample to the split, in either distance. */
+    void search(int32_t index, const Float *q, Candidates &c) const {
+      const Node &node = tree[index];
+
+      if (node.left < 0) {
+        for (uint32_t i=node.begin; i<node.end; i++)
+          c.offer(dist(q, &points[i*dims]), ids[i]);
+        return;
+      }
+
+      Float diff = q[node.feature] - node.split;
+      search(diff < 0 ? node.left : node.right, q, c);
+      if (fabs(diff) <= c.bound())
+        search(diff < 0 ? node.right : node.left, q, c);
+    }
+
+    /* compares m samples with the whole training set, in the order of GRT */
+    void brute_force(const Float *q, size_t m, Neighbours *nb) const {
+      vector<Float> qnorm(m);
+
+      for (size_t i=0; i<m; i++) {
+        Float mag = 0;
+        for (size_t j=0; j<dims; j++)
+          mag += q[i*dims + j] * q[i*dims + j];
+        qnorm[i] = sqrt(mag);
+      }
+
+      for (size_t b=0; b*LANES<n; b++) {
+        const Float *block = &blocks[b*LANES*dims];
+        size_t lanes = std::min(n - b*LANES, (size_t) LANES);
+
+        for (size_t i=0; i<m; i++) {
+          const Float *x = q + i*dims;
+          Float d[LANES] = { 0 };
+
+          switch (distance) {
+          case KNN::EUCLIDEAN_DISTANCE:
+            for (size_t j=0; j<dims; j++)
+              for (size_t l=0; l<LANES; l++)
+                d[l] += (x[j] - block[j*LANES + l]) * (x[j] - block[j*LANES + l]);
+            for (size_t l=0; l<LANES; l++)
+              d[l] = sqrt(d[l]);
+            break;
+          case KNN::COSINE_DISTANCE:
+            for (size_t j=0; j<dims; j++)
+              for (size_t l=0; l<LANES; l++)
+                d[l] += x[j] * block[j*LANES + l];
+            for (size_t l=0; l<LANES; l++)
+              d[l] = d[l] / (qnorm[i] * norms[b*LANES + l]);
+            break;
+          default:
+            for (size_t j=0; j<dims; j++)
+              for (size_t l=0; l<LANES; l++)
+                d[l] += fabs(x[j] - block[j*LANES + l]);
+          }
+
+          for (size_t l=0; l<lanes; l++)
+            nb[i].offer(d[l], b*LANES + l);
+        }
+      }
+    }
+
+    /* Votes like GRT: the first class with the most neighbours wins, and is
+     * rejected if their mean distance is above its threshold. Unless exact,
+     * returns false if the distances might be added up too differently from
+     * GRT for the threshold comparison to come out the same. */
+    bool decide(const vector<Neighbour> &neighbours, bool exact, UINT &predicted, Float &likelihood) const {
+      size_t C = labels.size(), best = 0;
+      vector<Float> counts(C, 0), distances(C, 0);
+
+      for (auto &nb : neighbours) {
+        counts[targets[nb.second]]++;
+        distances[targets[nb.second]] += nb.first;
+      }
+
+      for (size_t i=1; i<C; i++)
+        if (counts[i] > counts[best])
+          best = i;
+
+      likelihood = counts[best] / Float(neighbours.size());
+      predicted  = labels[best];
+
+      if (rejection) {
+        Float mean = distances[best] / counts[best];
+        if (!exact && fabs(mean - thresholds[best]) <= 1e-9 * fabs(thresholds[best]))
+          return false;
+        if (!(mean <= thresholds[best]))
+          predicted = 0;
+      }
+
+      return true;
+    }
+};
+
+#endif
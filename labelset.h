@@ -0,0 +1,98 @@
+#ifndef _LABELSET_H_
+#define _LABELSET_H_
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+/* Interns label strings into dense integer ids. The NULL label is always
+ * known and pinned to id 0, every other label gets the next free id on its
+ * first appearance. Lookups hash the label bytes into an open-addressing
+ * table of ids, so no temporary strings are created while parsing. */
+class LabelSet {
+  public:
+    enum : uint32_t { NONE = 0xffffffff };
+
+    LabelSet() : table(16, NONE) { intern("NULL"); }
+
+    uint32_t intern(const char *b, const char *e) {
+      size_t h = hash(b,e), mask = table.size()-1;
+
+      for (size_t i=h & mask; ; i=(i+1) & mask) {
+        uint32_t id = table[i];
+        if (id == NONE) {
+          id = names.size();
+          names.push_back(std::string(b, e-b));
+          hashes.push_back(h);
+          table[i] = id;
+          if (2*names.size() > table.size()) rehash();
+          return id;
+        }
+        if (hashes[id] == h && equals(id,b,e))
+          return id;
+      }
+    }
+
+    uint32_t intern(const std::string &label) {
+      return intern(label.data(), label.data() + label.size());
+    }
+
+    uint32_t intern(const char *label) {
+      return intern(label, label + strlen(label));
+    }
+
+    /* returns NONE if the label has not been interned yet */
+    uint32_t find(const char *b, const char *e) const {
+      size_t h = hash(b,e), mask = table.size()-1;
+
+      for (size_t i=h & mask; table[i] != NONE; i=(i+1) & mask)
+        if (hashes[table[i]] == h && equals(table[i],b,e))
+          return table[i];
+
+      return NONE;
+    }
+
+    uint32_t find(const std::string &label) const {
+      return find(label.data(), label.data() + label.size());
+    }
+
+    const std::string& operator[](size_t id) const { return names[id]; }
+    size_t size() const { return names.size(); }
+
+    std::vector<std::string>::const_iterator begin() const { return names.begin(); }
+    std::vector<std::string>::const_iterator end() const { return names.end(); }
+
+  protected:
+    std::vector<std::string> names;
+    std::vector<size_t> hashes;
+    std::vector<uint32_t> table;
+
+    /* FNV-1a */
+    static size_t hash(const char *b, const char *e) {
+      uint64_t h = 14695981039346656037ULL;
+      for (; b<e; b++)
+        h = (h ^ (unsigned char) *b) * 1099511628211ULL;
+      return h;
+    }
+
+    bool equals(uint32_t id, const char *b, const char *e) const {
+      const std::string &n = names[id];
+      return n.size() == (size_t)(e-b) && memcmp(n.data(), b, e-b) == 0;
+    }
+
+    void rehash() {
+      std::vector<uint32_t> t(2*table.size(), NONE);
+      size_t mask = t.size()-1;
+
+      for (uint32_t id=0; id<names.size(); id++) {
+        size_t i = hashes[id] & mask;
+        while (t[i] != NONE) i = (i+1) & mask;
+        t[i] = id;
+      }
+
+      table.swap(t);
+    }
+};
+
+#endif
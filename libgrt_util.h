@@ -2,6 +2,11 @@
 #define _CSVIO_H_
 
 #include "cmdline.h"
+#include "linereader.h"
+#include "labelset.h"
+#include "binio.h"
+#include "modelio.h"
+#include "output.h"
 #include <GRT.h>
 #include <iostream>
 #include <climits>
@@ -11,6 +16,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <sys/resource.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 using namespace GRT;
 using namespace std;
@@ -37,9 +47,18 @@ class CsvIOSample {
     RegressionData r_data;
     ClassificationSample c_data;
     TimeSeriesClassificationSample t_data;
-    Vector<string> labelset;
+    LabelSet labelset;
     bool has_NULL_label;
     int linenum;
+    int errline; // line whose dimension differs from the rest of its segment, 0 if none
+    std::string label;
+    VectorFloat row;
+    std::vector<Float> segment;
+
+    /* set when the input is a binary dataset, see binio.h */
+    BinaryDataset binary;
+    vector<uint32_t> binlabels;
+    uint64_t binrow, binsegment;
 
     static bool iscomment(std::string line) {
       for (int i=0; i<line.length(); i++) {
@@ -59,87 +78,197 @@ class CsvIOSample {
       return true;
     }
 
-    int classkey(std::string label) {
-      int i = std::find(labelset.begin(), labelset.end(), label) == labelset.end() ? -1 :
-              std::find(labelset.begin(), labelset.end(), label) - labelset.begin();
-      if (i==-1) {
-        labelset.push_back(label);
-        return labelset.size()-1;
-      }
+    int classkey(const char *b, const char *e) {
+      uint32_t i = labelset.intern(b,e);
       if (!has_NULL_label && i==0)
         has_NULL_label = true;
       return i;
     }
 
-    friend std::istream& operator>> (std::istream &in, CsvIOSample &o) 
+    int classkey(const std::string &label) {
+      return classkey(label.data(), label.data() + label.size());
+    }
+
+    /* lines are tokenized in-place, the label and the row buffer are kept
+     * between calls so that no allocation happens once they are sized. */
+    friend LineReader& operator>> (LineReader &in, CsvIOSample &o)
     {
       using namespace std;
 
-      string line, label;
-      Vector<VectorFloat> data;
-      double d;
+      const char *line, *end, *pos, *tok, *tokend, *lb, *le;
+      UINT rows = 0, cols = 0;
+
+      /* binary datasets are detected from their first byte */
+      if (o.linenum == 0 && !o.binary.good() &&
+          in.peek() == (unsigned char) GRT_BINARY_MAGIC[0])
+        o.openbinary(in);
+
+      if (o.binary.good())
+        return o.readbinary(in);
 
-      while (getline(in,line)) {
-        stringstream ss(line);
+      o.segment.clear();
+
+      while (in.getline(line,end)) {
         o.linenum++;
 
-        if (line.find_first_not_of(" \t") == string::npos) {
-          if (data.size()!=0)
+        for (pos=line; pos<end && (*pos==' ' || *pos=='\t'); pos++)
+          ;
+
+        if (pos == end) {
+          if (rows!=0)
             break;
           else
             continue;
         }
 
         if (line[0] == '#') {
-          if (o.type==UNKNOWN) o.settype(line);
+          if (o.type==UNKNOWN) o.settype(string(line,end));
           continue;
         }
 
         if (o.type==UNKNOWN)
           o.type = CLASSIFICATION; // default to classificaion
 
-        ss >> label;
-        VectorFloat sample;
-        string val;
-        while (ss >> val) // this also handles nan and infs correctly
-          sample.push_back(strtod(val.c_str(),NULL));
-
-        if (sample.size() == 0)
+        pos = line;
+        if (!next_token(pos,end,lb,le))
           continue;
 
-        data.push_back(sample);
+        if (o.type!=TIMESERIES) {
+          o.row.clear();
+          while (next_token(pos,end,tok,tokend)) // this also handles nan and infs correctly
+            o.row.push_back(parse_double(tok,tokend));
 
-        if (o.type!=TIMESERIES)
-          break;
-      }
+          if (o.row.size() == 0)
+            continue;
 
-      if (data.size() > 0) {
-        switch(o.type) {
-        case TIMESERIES: {
-          MatrixDouble md(data.size(), data.back().size());
-          md = data;
-          o.t_data = TimeSeriesClassificationSample(o.classkey(label), md);
-          break; }
-        case CLASSIFICATION:
-          o.c_data = ClassificationSample(o.classkey(label), data.back());
+          o.c_data.set(o.classkey(lb,le), o.row);
           break;
-        default:
-          throw invalid_argument("unknown data type");
         }
+
+        /* timeseries rows are appended to one row-major buffer */
+        size_t n = o.segment.size();
+        while (next_token(pos,end,tok,tokend))
+          o.segment.push_back(parse_double(tok,tokend));
+        n = o.segment.size() - n;
+
+        if (n == 0)
+          continue;
+
+        /* a segment can not be assembled from rows of different length,
+         * so reading stops there like at the end of input */
+        if (rows == 0)
+          cols = n;
+        else if (n != cols) {
+          o.errline = o.linenum;
+          in.setfail();
+          return in;
+        }
+
+        o.label.assign(lb, le-lb);
+        rows++;
+      }
+
+      if (o.type==TIMESERIES && rows > 0) {
+        MatrixFloat &m = o.timeseries(o.classkey(o.label), rows, cols);
+        for (UINT i=0; i<rows; i++)
+          std::copy(&o.segment[i*cols], &o.segment[i*cols] + cols, m[i]);
+        in.clear();
       }
 
-      if (data.size() != 0) in.clear();
       return in;
     }
 
     CsvIOSample(const std::string &t) {
       settype(t);
-      linenum = 0;
+      linenum = errline = 0;
       has_NULL_label = false;
-      labelset.push_back("NULL");
     }
 
   protected:
+  friend class CollectDataset;
+
+  /* a corrupt binary dataset can not be read any further, so like extract
+   * does this is reported and the tool exits */
+  void openbinary(LineReader &in) {
+    if (!in.slurp() || !binary.open(in.data(), in.data_end())) {
+      cerr << "ERR: invalid binary dataset" << endl;
+      exit(-1);
+    }
+
+    binlabels.clear();
+    for (auto &l : binary.labelset)
+      binlabels.push_back(labelset.intern(l));
+
+    if (type==UNKNOWN)
+      type = binary.timeseries() ? TIMESERIES : CLASSIFICATION;
+
+    binrow = binsegment = 0;
+    in.consume(in.data_end());
+  }
+
+  /* emits the same samples the text parser would produce for the text form
+   * of the dataset: every row for classification, every segment (or all
+   * rows of a classification dataset) for timeseries. */
+  LineReader& readbinary(LineReader &in) {
+    const grt_binary_header &h = binary.header;
+    uint64_t first, last, sample;
+
+    if (type == TIMESERIES) {
+      if (binary.timeseries()) {
+        while (binsegment < h.samples &&
+               binary.segment_begin(binsegment) == binary.segment_end(binsegment))
+          binsegment++;
+        if (binsegment >= h.samples)
+          return in.setfail(), in;
+        sample = binsegment++;
+        first  = binary.segment_begin(sample);
+        last   = binary.segment_end(sample);
+      } else {
+        if (binsegment++ > 0 || h.rows == 0)
+          return in.setfail(), in;
+        sample = h.samples-1;
+        first  = 0;
+        last   = h.rows;
+      }
+
+      MatrixFloat &m = timeseries(binkey(sample), last-first, h.dims);
+      for (uint32_t j=0; j<h.dims; j++)
+        for (uint64_t i=first; i<last; i++)
+          m[i-first][j] = binary.value(i,j);
+
+      linenum = sample+1;
+      return in;
+    }
+
+    if (binrow >= h.rows)
+      return in.setfail(), in;
+
+    while (binsegment < h.samples && binary.segment_end(binsegment) <= binrow)
+      binsegment++;
+
+    row.resize(h.dims);
+    binary.row(binrow++, &row[0]);
+    c_data.set(binkey(binsegment), row);
+    linenum = binrow;
+    return in;
+  }
+
+  /* resets t_data to the given label and returns its matrix, sized so that
+   * the segment can be written into it directly */
+  MatrixFloat& timeseries(UINT cl, UINT rows, UINT cols) {
+    t_data.setTrainingSample(cl, MatrixFloat());
+    MatrixFloat &m = t_data.getData();
+    m.resize(rows, cols);
+    return m;
+  }
+
+  int binkey(uint64_t sample) {
+    uint32_t i = binlabels[binary.label(sample)];
+    if (!has_NULL_label && i==0)
+      has_NULL_label = true;
+    return i;
+  }
+
   void settype(const std::string &t) {
     using namespace std;
     if (t.find("classification") != string::npos)
@@ -155,20 +284,96 @@ class CsvIOSample {
   }
 };
 
+/* samples parsed from one chunk of the input, label ids are local to the
+ * chunk's labelset and lines are counted from the chunk start */
+struct ParsedChunk {
+  struct sample { uint32_t label; int line; size_t offset; UINT rows, cols; };
+
+  const char *begin, *end;
+  LabelSet labelset;
+  vector<Float> values;
+  vector<sample> samples;
+  int lines;
+  bool done, failed;
+
+  ParsedChunk() : begin(NULL), end(NULL), lines(0), done(false), failed(false) {}
+
+  void parse(csv_type_t type) {
+    CsvIOSample io(type==TIMESERIES ? "timeseries" : "classification");
+    LineReader in(begin, end);
+    io.linenum = 1; // the middle of a file is never taken for a binary header
+
+    while (in >> io) {
+      sample s;
+      s.line   = io.linenum - 1;
+      s.offset = values.size();
+
+      if (type == TIMESERIES) {
+        MatrixFloat &m = io.t_data.getData();
+        s.label = io.t_data.getClassLabel();
+        s.rows  = m.getNumRows();
+        s.cols  = m.getNumCols();
+        for (UINT i=0; i<s.rows; i++)
+          values.insert(values.end(), m[i], m[i] + s.cols);
+      } else {
+        VectorFloat &v = io.c_data.getSample();
+        s.label = io.c_data.getClassLabel();
+        s.rows  = 1;
+        s.cols  = v.size();
+        values.insert(values.end(), v.begin(), v.end());
+      }
+
+      samples.push_back(s);
+    }
+
+    failed = io.errline != 0;
+    lines = io.linenum - 1;
+    labelset = io.labelset;
+  }
+
+  void release() {
+    vector<Float>().swap(values);
+    vector<sample>().swap(samples);
+    labelset = LabelSet();
+  }
+};
+
 class CollectDataset
 {
   public:
   TimeSeriesClassificationData t_data;
   ClassificationData c_data;
   csv_type_t type;
+  int errline; // line of the first sample that could not be added, 0 if none
+
+  /* regular files smaller than this are always read sequentially */
+  static const size_t CHUNK_SIZE = 1<<20;
 
   CollectDataset() {
     t_data.setAllowNullGestureClass(true);
     c_data.setAllowNullGestureClass(true);
     type = UNKNOWN;
+    errline = 0;
   }
 
-  bool add(TimeSeriesClassificationSample &sample, Vector<string> &labels) {
+  /* reads all samples from the input, returns false if some of them could not
+   * be added or reading stopped at a line that could not be parsed. Large
+   * regular files are parsed on up to threads threads (0 for all cores),
+   * which results in the same dataset as reading sequentially. */
+  bool read(LineReader &in, CsvIOSample &io, int threads=1) {
+    if (!readparallel(in, io, threads))
+      while (in >> io) {
+        bool ok=false; csvio_dispatch(io, ok=add, io.labelset);
+        if (!ok && errline == 0) errline = io.linenum;
+      }
+
+    if (io.errline != 0 && errline == 0)
+      errline = io.errline;
+
+    return errline == 0;
+  }
+
+  bool add(TimeSeriesClassificationSample &sample, LabelSet &labels) {
     type = TIMESERIES;
     UINT cl = sample.getClassLabel();
 
@@ -177,11 +382,12 @@ class CollectDataset
 
     if (!t_data.addSample(sample.getClassLabel(), sample.getData()))
       return false;
-    t_data.setClassNameForCorrespondingClassLabel(labels[cl], cl);
+    if (!named(cl))
+      t_data.setClassNameForCorrespondingClassLabel(labels[cl], cl);
     return true;
   }
 
-  bool add(ClassificationSample &sample, Vector<string> &labels) {
+  bool add(ClassificationSample &sample, LabelSet &labels) {
     type = CLASSIFICATION;
     UINT cl = sample.getClassLabel();
 
@@ -190,7 +396,8 @@ class CollectDataset
 
     if (!c_data.addSample(sample.getClassLabel(), sample.getSample()))
       return false;
-    c_data.setClassNameForCorrespondingClassLabel(labels[cl], cl);
+    if (!named(cl))
+      c_data.setClassNameForCorrespondingClassLabel(labels[cl], cl);
     return true;
   }
 
@@ -215,6 +422,145 @@ class CollectDataset
       return 0;
     }
   }
+
+  protected:
+  /* Splits the mapped input into chunks at line boundaries, or behind blank
+   * lines for timeseries so no segment crosses a chunk. Chunks are parsed by
+   * a pool of threads and merged in input order while the pool continues, the
+   * labels of each chunk are interned in their order of appearance so the
+   * label ids match the sequential path. Returns false if the input is not
+   * suited and should be read sequentially. */
+  bool readparallel(LineReader &in, CsvIOSample &io, int threads) {
+    if (threads <= 0)
+      threads = thread::hardware_concurrency();
+
+    if (threads <= 1 || !in.mapped() || io.binary.good() ||
+        in.peek() == (unsigned char) GRT_BINARY_MAGIC[0] || !in.slurp())
+      return false;
+
+    const char *begin = in.data(), *end = in.data_end(), *line, *last;
+    size_t nchunks = std::min((size_t) threads*4, (size_t) (end-begin) / CHUNK_SIZE);
+    if (nchunks < 2)
+      return false;
+
+    /* the type is decided like the parser would, by comments before data */
+    LineReader head(begin, end);
+    while (io.type == UNKNOWN && head.getline(line,last)) {
+      const char *p = line;
+      while (p<last && (*p==' ' || *p=='\t')) p++;
+      if (line[0] == '#')
+        io.settype(string(line,last));
+      else if (p != last)
+        io.type = CLASSIFICATION;
+    }
+
+    if (io.type == UNKNOWN)
+      return false;
+
+    vector<ParsedChunk> chunks(nchunks);
+    const char *p = begin;
+    for (size_t i=0; i<nchunks; i++) {
+      chunks[i].begin = p;
+      p = std::max(p, begin + (end-begin) * (i+1) / nchunks);
+      p = lr_linestart(begin, p, end);
+      if (io.type == TIMESERIES) p = lr_afterblank(p, end);
+      chunks[i].end = i+1 == nchunks ? end : p;
+    }
+
+    mutex lock;
+    condition_variable ready;
+    atomic<size_t> next(0);
+    atomic<bool> stop(false);
+    csv_type_t t = io.type;
+    vector<thread> pool;
+
+    for (int i=0; i<threads; i++)
+      pool.push_back(thread([&]() {
+        for (size_t k; !stop && (k = next++) < nchunks; ) {
+          chunks[k].parse(t);
+          lock_guard<mutex> guard(lock);
+          chunks[k].done = true;
+          ready.notify_all();
+        }
+      }));
+
+    int linenum = io.linenum;
+    size_t k = 0;
+    for (; k<nchunks; k++) {
+      unique_lock<mutex> guard(lock);
+      ready.wait(guard, [&]() { return chunks[k].done; });
+      guard.unlock();
+
+      if (chunks[k].failed)
+        break;
+
+      merge(chunks[k], io, linenum);
+      linenum += chunks[k].lines;
+      chunks[k].release();
+    }
+
+    stop = true;
+    for (auto &th : pool)
+      th.join();
+
+    /* parse errors are found again by the sequential parser, which reports
+     * them with the correct line number */
+    for (; k<nchunks && io.errline == 0; k++) {
+      LineReader rest(chunks[k].begin, chunks[k].end);
+      io.linenum = linenum;
+      while (rest >> io) {
+        bool ok=false; csvio_dispatch(io, ok=add, io.labelset);
+        if (!ok && errline == 0) errline = io.linenum;
+      }
+      linenum = io.linenum;
+    }
+
+    io.linenum = linenum;
+    in.consume(end);
+    in.setfail();
+    return true;
+  }
+
+  void merge(ParsedChunk &chunk, CsvIOSample &io, int linenum) {
+    vector<uint32_t> ids;
+    for (auto &l : chunk.labelset)
+      ids.push_back(io.labelset.intern(l));
+
+    for (auto &s : chunk.samples) {
+      uint32_t cl = ids[s.label];
+      const Float *v = &chunk.values[s.offset];
+      bool ok;
+
+      if (cl == 0)
+        io.has_NULL_label = true;
+
+      if (io.type == TIMESERIES) {
+        MatrixFloat &m = io.timeseries(cl, s.rows, s.cols);
+        for (UINT i=0; i<s.rows; i++)
+          std::copy(v + i*s.cols, v + (i+1)*s.cols, m[i]);
+        ok = add(io.t_data, io.labelset);
+      } else {
+        io.row.assign(v, v + s.cols);
+        io.c_data.set(cl, io.row);
+        ok = add(io.c_data, io.labelset);
+      }
+
+      if (!ok && errline == 0)
+        errline = linenum + s.line;
+    }
+  }
+
+  /* the class name only needs to be set once per label id, returns whether
+   * that already happened and marks the id otherwise */
+  vector<bool> has_name;
+
+  bool named(UINT cl) {
+    if (cl >= has_name.size())
+      has_name.resize(cl+1, false);
+    bool was = has_name[cl];
+    has_name[cl] = true;
+    return was;
+  }
 };
 
 class CerrLogger : public Observer< GRT::TrainingLogMessage >,
@@ -294,6 +640,14 @@ void set_verbosity(int level) {
   }
 }
 
+/* largest resident set size of this process so far */
+static double peak_memory_mb() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+  return usage.ru_maxrss / 1024.;
+}
+
 
 static bool *is_running_indicator;
 
@@ -331,35 +685,258 @@ FeatureExtraction *loadFeatureExtractionFromFile(string &file) {
   return feature;
 }
 
-Classifier *loadClassifierFromFile(istream &file)
+/* Models written by grt train start with a few comment lines naming the
+ * classifier, so loading does not have to try every registered one:
+ *
+ *   # grtool model 1
+ *   # classifier KNN
+ *   # dimensions 3
+ *   # classes NULL abc cde
+ *
+ * followed by the model as saved by GRT. */
+#define GRT_MODEL_HEADER  "# grtool model"
+#define GRT_MODEL_VERSION 1
+
+struct ModelHeader {
+  int version;
+  string classifier;
+  UINT dimensions;
+  vector<string> classes;
+  shared_ptr<BinaryModel> sections; // of a binary model, NULL for text models
+
+  ModelHeader() : version(0), dimensions(0) {}
+};
+
+void saveModelHeader(ostream &file, Classifier *classifier, const LabelSet &labels)
+{
+  file << GRT_MODEL_HEADER << " " << GRT_MODEL_VERSION << endl;
+  file << "# classifier " << classifier->getClassifierType() << endl;
+  file << "# dimensions " << classifier->getNumInputDimensions() << endl;
+  file << "# classes";
+  for (auto &l : labels)
+    file << " " << l;
+  file << endl;
+}
+
+/* parses the header comment lines at the start of file, if there are any */
+static void readModelHeader(istream &file, ModelHeader &h)
+{
+  string line;
+
+  while (file.peek()=='#' && getline(file,line)) {
+    if (line.compare(0, strlen(GRT_MODEL_HEADER), GRT_MODEL_HEADER)==0) {
+      h.version = atoi(line.c_str() + strlen(GRT_MODEL_HEADER));
+      continue;
+    }
+
+    istringstream fields(line.substr(1));
+    string key, name;
+    fields >> key;
+    if (key == "classifier")      fields >> h.classifier;
+    else if (key == "dimensions") fields >> h.dimensions;
+    else if (key == "classes")    while (fields >> name) h.classes.push_back(name);
+  }
+}
+
+/* loads a GRT model from memory with the classifier named in the header, or
+ * tries every registered classifier if there is none */
+static Classifier *loadClassifierFromMemory(const ModelHeader &h, const char *begin, const char *end)
+{
+  vector<string> candidates;
+
+  if (h.classifier != "")
+    candidates.push_back(h.classifier);
+
+  for (string c : Classifier::getRegisteredClassifiers())
+    if (c != "ParticleClassifier")
+      candidates.push_back(c);
+
+  for (size_t i=0; i<candidates.size(); i++) {
+    Classifier *classifier = Classifier::createInstanceFromString(candidates[i]);
+    MemoryBuffer buf(begin, end);
+    istream in(&buf);
+
+    if (classifier != NULL && classifier->loadModelFromFile(in))
+      return classifier;
+    if (classifier != NULL) delete classifier;
+  }
+
+  return NULL;
+}
+
+/* KNN keeps its training set protected, a member pointer reaches it */
+struct KNNTrainingData : KNN {
+  static ClassificationData &of(KNN *knn) { return knn->*(&KNNTrainingData::trainingData); }
+};
+
+/* Binary models (grt train --binary) keep the header and the GRT model in
+ * sections of a BinaryModel, see modelio.h, together with the compiled form
+ * of the classifier if it has one, which is predicted from in place. The
+ * GRT model itself is still loaded from its text, so except for KNN this
+ * takes as long as loading a text model. KNN is saved without its training
+ * set, which is kept as a binary dataset and copied into the classifier, so
+ * the samples are not parsed and the classifier is not trained again. */
+bool saveBinaryModel(ostream &file, Classifier *classifier, const LabelSet &labels,
+                     BinaryModelWriter model = BinaryModelWriter())
+{
+  stringstream header, text;
+  KNN *knn = dynamic_cast<KNN*>(classifier);
+
+  saveModelHeader(header, classifier, labels);
+  model.add("header", header.str());
+
+  if (knn == NULL) {
+    if (!classifier->saveModelToFile(text))
+      return false;
+    model.add("model", text.str());
+    return model.write(file);
+  }
+
+  ClassificationData &data = KNNTrainingData::of(knn);
+  ClassificationData samples = data;
+  BinaryDatasetWriter dataset(false, false);
+  for (UINT i=0; i<samples.getNumSamples(); i++) {
+    ClassificationSample &s = samples[i];
+    dataset.add_row(&s.getSample()[0], s.getNumDimensions());
+    dataset.end_sample(s.getClassLabel());
+  }
+
+  data.clear();
+  bool ok = classifier->saveModelToFile(text);
+  data = samples;
+  if (!ok)
+    return false;
+  model.add("model", text.str());
+
+  char *buf = NULL; size_t n = 0;
+  FILE *f = open_memstream(&buf, &n);
+  ok = f != NULL && dataset.write(f, vector<string>(labels.begin(), labels.end()));
+  if (f != NULL) fclose(f);
+  if (ok) model.add("samples", buf, n);
+  free(buf);
+
+  return ok && model.write(file);
+}
+
+/* gives a KNN loaded without training set its samples */
+static bool loadKNNSamples(KNN *knn, const char *begin, const char *end)
+{
+  BinaryDataset dataset;
+  UINT dims = knn->getNumInputDimensions();
+
+  if (!dataset.open(begin,end) || dataset.timeseries() || dataset.header.dims != dims)
+    return false;
+
+  ClassificationData &data = KNNTrainingData::of(knn);
+  data.clear();
+  data.setNumDimensions(dims);
+  data.reserve(dataset.header.rows);
+
+  VectorFloat row(dims);
+  for (uint64_t i=0; i<dataset.header.rows; i++) {
+    dataset.row(i, &row[0]);
+    if (!data.addSample(dataset.label(i), row))
+      return false;
+  }
+
+  return true;
+}
+
+static Classifier *loadBinaryModel(const char *begin, const char *end, ModelHeader &h,
+                                   shared_ptr<const void> keep = shared_ptr<const void>())
+{
+  shared_ptr<BinaryModel> model(new BinaryModel);
+  const char *b, *e;
+
+  if (!model->open(begin,end,keep) || !model->section("header", b, e))
+    return NULL;
+
+  MemoryBuffer buf(b, e);
+  istream header(&buf);
+  readModelHeader(header, h);
+
+  if (!model->section("model", b, e))
+    return NULL;
+
+  Classifier *classifier = loadClassifierFromMemory(h, b, e);
+  KNN *knn = dynamic_cast<KNN*>(classifier);
+
+  if (knn != NULL && model->section("samples", b, e) && !loadKNNSamples(knn, b, e)) {
+    delete classifier;
+    return NULL;
+  }
+
+  if (classifier != NULL)
+    h.sections = model;
+  return classifier;
+}
+
+Classifier *loadClassifierFromFile(istream &file, ModelHeader *header=NULL)
 {
   ErrorLog err;
   Classifier *classifier = NULL;
   bool errlog = err.getLoggingEnabled();
   ErrorLog::enableLogging(false);
+  ModelHeader h;
+
+  if (file.peek() == (unsigned char) GRT_MODEL_MAGIC[0]) {
+    // binary models know their length, so exactly the model is read
+    grt_model_header mh;
+    shared_ptr<string> buf(new string(sizeof(mh), 0));
+
+    if (file.read(&(*buf)[0], buf->size())) {
+      memcpy(&mh, buf->data(), sizeof(mh));
+      if (mh.length > buf->size() && mh.length < (1ULL<<40)) {
+        buf->resize(mh.length);
+        file.read(&(*buf)[sizeof(mh)], mh.length - sizeof(mh));
+      }
+      if (file)
+        classifier = loadBinaryModel(buf->data(), buf->data() + buf->size(), h, buf);
+    }
+  } else {
+    // for input pipes we need to buffer, so load the file completly into
+    // memory or until an empty line has been read.
+    stringstream ss;
+    string line;
+
+    readModelHeader(file, h);
+    while (getline(file,line)) {
+      if (trim(line)=="") break;
+      ss << line << endl;
+    }
 
-  // for input pipes we need to buffer, so load the file completly into
-  // memory or until an empty line has been read.
-  stringstream ss;
-  string line;
-
-  while (getline(file,line)) {
-    if (trim(line)=="") break;
-    ss << line << endl;
+    string model = ss.str();
+    classifier = loadClassifierFromMemory(h, model.data(), model.data() + model.size());
   }
 
-  for (string c : Classifier::getRegisteredClassifiers()) {
-    classifier  = Classifier::createInstanceFromString(c);
+  if (header != NULL)
+    *header = h;
 
-    stringstream in(ss.str());
-    bool loaded = classifier->loadModelFromFile(in);
+  ErrorLog::enableLogging(true);
+  return classifier;
+}
 
-    if (c != "ParticleClassifier" && loaded)
-      break;
-    if (classifier != NULL) delete classifier;
-    classifier = NULL;
+/* model files in the binary format are mapped instead of read, the mapping
+ * stays until neither the header nor a model compiled from it is used */
+Classifier *loadClassifierFromFile(const string &filename, ModelHeader *header=NULL)
+{
+  shared_ptr<LineReader> in(new LineReader);
+
+  if (!in->open(filename))
+    return NULL;
+
+  if (in->peek() != (unsigned char) GRT_MODEL_MAGIC[0] || !in->slurp()) {
+    ifstream fin(filename);
+    return loadClassifierFromFile(fin, header);
   }
 
+  ErrorLog::enableLogging(false);
+  ModelHeader h;
+  Classifier *classifier = loadBinaryModel(in->data(), in->data_end(), h, in);
+
+  if (header != NULL)
+    *header = h;
+
   ErrorLog::enableLogging(true);
   return classifier;
 }
@@ -377,5 +954,15 @@ grt_fileinput(cmdline::parser &c, int num=0) {
   return inf;
 }
 
+LineReader&
+grt_lineinput(cmdline::parser &c, int num=0) {
+  static LineReader inf;
+  string filename = c.rest().size() > num ? c.rest()[num] : "-";
+
+  if (!inf.open(filename))
+    cerr << "unable to open file: " << filename << endl;
+  return inf;
+}
+
 
 #endif
@@ -0,0 +1,285 @@
+#ifndef _LINEREADER_H_
+#define _LINEREADER_H_
+
+#include <string>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Line-based input without per-line copies. Regular files are mapped into
+ * memory and lines point directly into the map. Everything else (pipes,
+ * terminals) is read line by line through stdio with a large buffer, which
+ * does not block for more than a line and keeps data already buffered by
+ * cin/stdin. Lines are valid until the next call to getline(). */
+class LineReader {
+  public:
+    static const size_t BLOCK_SIZE = 1<<20;
+
+    LineReader() { init(); }
+    LineReader(FILE *f) { init(); open(f); }
+    LineReader(const char *begin, const char *end) { init(); open(begin,end); }
+    ~LineReader() { close(); }
+
+    /* open a file by name, "-" is stdin. Since no data has been read from
+     * the stream yet, it is safe to enlarge its buffer here. */
+    bool open(const std::string &filename) {
+      close();
+      FILE *f = filename=="-" ? stdin : fopen(filename.c_str(), "r");
+
+      if (f == NULL)
+        return failed = true, false;
+
+      owned = f != stdin;
+      open(f);
+      if (!map) setvbuf(f, NULL, _IOFBF, BLOCK_SIZE);
+      return true;
+    }
+
+    bool open(FILE *f) {
+      struct stat st;
+      file = f;
+      failed = false;
+
+      /* map regular files, the position is taken from stdio on first read */
+      if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+        if (m != MAP_FAILED) {
+          madvise(m, st.st_size, MADV_SEQUENTIAL);
+          map = (const char*) m;
+          maplen = st.st_size;
+          end = map + maplen;
+        }
+      }
+
+      return true;
+    }
+
+    bool open(const char *begin, const char *last) {
+      close();
+      pos = begin;
+      end = last;
+      return true;
+    }
+
+    void close() {
+      if (map) munmap((void*) map, maplen);
+      if (owned && file) fclose(file);
+      free(buf);
+      init();
+    }
+
+    /* returns false when no more lines can be read. The line excludes the
+     * trailing newline. */
+    bool getline(const char *&line, const char *&last) {
+      if (!mapped()) {
+        ssize_t n = getdelim(&buf, &bufsize, '\n', file);
+        if (n <= 0) return failed = true, false;
+        line = buf; last = buf + n - (buf[n-1]=='\n');
+        return true;
+      }
+
+      if (pos == NULL) position();
+      if (pos == end)
+        return failed = true, false;
+
+      const char *nl = (const char*) memchr(pos, '\n', end-pos);
+      line = pos; last = nl ? nl : end;
+      pos  = nl ? nl+1 : end;
+      return true;
+    }
+
+    bool getline(std::string &line) {
+      const char *b, *e;
+      if (!getline(b,e)) return false;
+      line.assign(b, e-b);
+      return true;
+    }
+
+    /* blocks until data is available, returns EOF if there is none */
+    int peek() {
+      if (mapped()) {
+        const char *p = pos==NULL && map ? map + ftell(file) : pos;
+        return p >= end ? EOF : (unsigned char) *p;
+      }
+
+      int c = getc(file);
+      if (c != EOF) ungetc(c, file);
+      return c;
+    }
+
+    /* memory-mapped or in-memory range, i.e. the whole input is accessible */
+    bool mapped() const { return file == NULL || map != NULL; }
+    const char *data() const { return pos; }
+    const char *data_end() const { return end; }
+
+    /* make the remaining input accessible through data(), pipes are read
+     * completely into memory for this */
+    bool slurp() {
+      if (mapped()) {
+        if (pos == NULL) position();
+        return true;
+      }
+
+      size_t n = 0, cap = BLOCK_SIZE;
+      char *b = (char*) malloc(cap);
+      while (b && (n += fread(b+n, 1, cap-n, file)) == cap) {
+        char *larger = (char*) realloc(b, cap *= 2);
+        if (larger == NULL) free(b);
+        b = larger;
+      }
+
+      if (b == NULL)
+        return failed = true, false;
+
+      free(buf);
+      buf = b; bufsize = cap;
+      if (owned) fclose(file);
+      file = NULL; owned = false;
+      pos = buf; end = buf + n;
+      return true;
+    }
+
+    /* continue reading lines at p, which must lie within data() */
+    void consume(const char *p) { pos = p; }
+
+    /* like an istream this fails once reading past the end of input */
+    operator bool() const { return !failed; }
+    bool operator!() const { return failed; }
+    void clear() { failed = false; }
+    void setfail() { failed = true; }
+
+  protected:
+    FILE *file;
+    bool owned, failed;
+    const char *map;
+    size_t maplen;
+    char *buf;
+    size_t bufsize;
+    const char *pos, *end;
+
+    /* the stdio stream might have been read from after opening (e.g. a model
+     * that preceeds the data on stdin), so start reading the map from the
+     * logical position of the stream. */
+    void position() {
+      if (map == NULL) return;
+      long offset = ftell(file);
+      pos = map + (offset < 0 ? 0 : offset);
+      if (pos > end) pos = end;
+    }
+
+    void init() {
+      file = NULL; owned = failed = false;
+      map = NULL; maplen = 0;
+      buf = NULL; bufsize = 0;
+      pos = end = NULL;
+    }
+};
+
+/* whitespace as understood by operator>> in the classic locale */
+static inline bool lr_isspace(char c) {
+  return c==' ' || c=='\t' || c=='\n' || c=='\v' || c=='\f' || c=='\r';
+}
+
+/* splits [pos,end) on whitespace, returns false if there is no token left */
+static inline bool next_token(const char *&pos, const char *end,
+                              const char *&tok, const char *&tokend) {
+  while (pos < end && lr_isspace(*pos)) pos++;
+  if (pos == end) return false;
+  tok = pos;
+  while (pos < end && !lr_isspace(*pos)) pos++;
+  tokend = pos;
+  return true;
+}
+
+/* start of the first line at or after p */
+static inline const char* lr_linestart(const char *begin, const char *p, const char *end) {
+  if (p <= begin) return begin;
+  if (p >= end || p[-1] == '\n') return p;
+  const char *nl = (const char*) memchr(p, '\n', end-p);
+  return nl ? nl+1 : end;
+}
+
+/* position behind the first blank line (spaces and tabs only) found when
+ * reading lines from the line start p, or end if there is none */
+static inline const char* lr_afterblank(const char *p, const char *end) {
+  while (p < end) {
+    const char *nl = (const char*) memchr(p, '\n', end-p), *e = nl ? nl : end, *q = p;
+    while (q < e && (*q==' ' || *q=='\t')) q++;
+    p = nl ? nl+1 : end;
+    if (q == e) return p;
+  }
+  return end;
+}
+
+/* Locale-independent float parsing for the common case of plain decimal
+ * numbers. Values with at most 19 significant digits whose mantissa fits a
+ * double exactly and a decimal exponent within [-22,22] are correctly
+ * rounded with a single multiplication or division (Clinger's fast path).
+ * Everything else, like nan, inf, hex floats or trailing garbage, is handed
+ * to strtod so results are identical to what strtod returns. */
+static inline double parse_double(const char *tok, const char *tokend) {
+  static const double pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+  const char *p = tok;
+  bool negative = false;
+  uint64_t mantissa = 0;
+  int digits = 0, exponent = 0, ndigits = 0;
+
+  if (p < tokend && (*p=='-' || *p=='+'))
+    negative = *p++ == '-';
+
+  for (; p < tokend && *p>='0' && *p<='9'; p++, ndigits++)
+    if (mantissa || *p!='0') {
+      mantissa = mantissa*10 + (*p-'0');
+      digits++;
+    }
+
+  if (p < tokend && *p=='.')
+    for (p++; p < tokend && *p>='0' && *p<='9'; p++, ndigits++) {
+      if (mantissa || *p!='0') {
+        mantissa = mantissa*10 + (*p-'0');
+        digits++;
+      }
+      exponent--;
+    }
+
+  if (ndigits && p < tokend && (*p=='e' || *p=='E')) {
+    const char *q = p+1;
+    bool eneg = false;
+    int e = 0;
+
+    if (q < tokend && (*q=='-' || *q=='+'))
+      eneg = *q++ == '-';
+    if (q < tokend && *q>='0' && *q<='9') {
+      for (; q < tokend && *q>='0' && *q<='9'; q++)
+        if (e < 10000) e = e*10 + (*q-'0');
+      exponent += eneg ? -e : e;
+      p = q;
+    }
+  }
+
+  if (ndigits && p == tokend && digits <= 19 && mantissa <= (1ULL<<53) &&
+      exponent >= -22 && exponent <= 22) {
+    double v = (double) mantissa;
+    v = exponent < 0 ? v / pow10[-exponent] : v * pow10[exponent];
+    return negative ? -v : v;
+  }
+
+  /* slow path, strtod needs a terminated string */
+  char small[64];
+  size_t n = tokend - tok;
+  if (n < sizeof(small)) {
+    memcpy(small, tok, n); small[n] = 0;
+    return strtod(small, NULL);
+  }
+  return strtod(std::string(tok, n).c_str(), NULL);
+}
+
+#endif
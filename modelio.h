@@ -0,0 +1,233 @@
+#ifndef _MODELIO_H_
+#define _MODELIO_H_
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <ostream>
+#include <streambuf>
+#include <memory>
+
+/* Binary model container as written by grt train --binary. It holds a list
+ * of named sections, each starting on an 8-byte boundary. A model file is
+ * mapped to read it. GRT classifiers own their data and are built from
+ * copies of their sections, but the compiled forms of a model (see
+ * compiled.h) predict from the arrays in the mapping, which are shared by
+ * every process that maps the same file:
+ *
+ *  header        see below
+ *  sections      nsections times (name, offset, length)
+ *  data          the section contents
+ *
+ * The total length is part of the header so that a model can be read from
+ * a pipe that continues with data after it. */
+#define GRT_MODEL_MAGIC          "\x89GRM\r\n\x1a\n"
+#define GRT_MODEL_BINARY_VERSION 1
+#define GRT_MODEL_ORDER          0x01020304
+
+struct grt_model_header {
+  char     magic[8];
+  uint32_t version, byteorder;
+  uint64_t length;
+  uint32_t nsections, reserved;
+};
+
+struct grt_model_section {
+  char     name[16];
+  uint64_t offset, length;
+};
+
+/* read-only view of a binary model in memory, e.g. a mapped file */
+class BinaryModel {
+  public:
+    grt_model_header header;
+
+    BinaryModel() : base(NULL) {}
+
+    static bool ismagic(const char *begin, const char *end) {
+      return (size_t)(end-begin) >= 8 && memcmp(begin, GRT_MODEL_MAGIC, 8) == 0;
+    }
+
+    /* keep is whatever holds the memory, e.g. the mapping, which is kept
+     * alive by every array that refers to it */
+    bool open(const char *begin, const char *end,
+              std::shared_ptr<const void> keep = std::shared_ptr<const void>()) {
+      uint64_t length = end-begin;
+      base = NULL;
+      sections.clear();
+      storage = keep;
+
+      if (length < sizeof(header) || !ismagic(begin,end))
+        return false;
+
+      memcpy(&header, begin, sizeof(header));
+      if (header.version != GRT_MODEL_BINARY_VERSION || header.byteorder != GRT_MODEL_ORDER ||
+          header.length > length ||
+          header.nsections > (length - sizeof(header)) / sizeof(grt_model_section))
+        return false;
+
+      for (uint32_t i=0; i<header.nsections; i++) {
+        grt_model_section s;
+        memcpy(&s, begin + sizeof(header) + i*sizeof(s), sizeof(s));
+        if (s.offset > header.length || s.length > header.length - s.offset)
+          return false;
+        sections.push_back(s);
+      }
+
+      base = begin;
+      return true;
+    }
+
+    bool good() const { return base != NULL; }
+
+    /* returns false if there is no section of that name */
+    bool section(const std::string &name, const char *&begin, const char *&end) const {
+      for (auto &s : sections)
+        if (strncmp(s.name, name.c_str(), sizeof(s.name)) == 0) {
+          begin = base + s.offset;
+          end   = begin + s.length;
+          return true;
+        }
+      return false;
+    }
+
+    bool has(const std::string &name) const {
+      const char *b, *e;
+      return section(name, b, e);
+    }
+
+    /* copies a section of fixed size, e.g. a struct of parameters */
+    template <typename T>
+    bool get(const std::string &name, T &value) const {
+      const char *b, *e;
+      if (!section(name, b, e) || (size_t)(e-b) != sizeof(T))
+        return false;
+      memcpy(&value, b, sizeof(T));
+      return true;
+    }
+
+    std::shared_ptr<const void> keep() const { return storage; }
+
+  protected:
+    const char *base;
+    std::vector<grt_model_section> sections;
+    std::shared_ptr<const void> storage;
+};
+
+/* collects named sections and writes them as one binary model */
+class BinaryModelWriter {
+  public:
+    void add(const std::string &name, const void *data, size_t n) {
+      names.push_back(name);
+      contents.push_back(n ? std::string((const char*) data, n) : std::string());
+    }
+
+    /* a section of fixed size, e.g. a struct of parameters */
+    template <typename T>
+    void put(const std::string &name, const T &value) {
+      add(name, &value, sizeof(T));
+    }
+
+    void add(const std::string &name, const std::string &data) {
+      add(name, data.data(), data.size());
+    }
+
+    bool write(std::ostream &out) const {
+      grt_model_header h;
+      memset(&h, 0, sizeof(h));
+      memcpy(h.magic, GRT_MODEL_MAGIC, sizeof(h.magic));
+      h.version   = GRT_MODEL_BINARY_VERSION;
+      h.byteorder = GRT_MODEL_ORDER;
+      h.nsections = names.size();
+
+      std::vector<grt_model_section> table(names.size());
+      uint64_t off = align(sizeof(h) + table.size()*sizeof(grt_model_section));
+      for (size_t i=0; i<names.size(); i++) {
+        memset(&table[i], 0, sizeof(table[i]));
+        strncpy(table[i].name, names[i].c_str(), sizeof(table[i].name));
+        table[i].offset = off;
+        table[i].length = contents[i].size();
+        off = align(off + contents[i].size());
+      }
+      h.length = off;
+
+      static const char zeros[8] = {0};
+      uint64_t pos = sizeof(h) + table.size()*sizeof(grt_model_section);
+      out.write((const char*) &h, sizeof(h));
+      if (!table.empty())
+        out.write((const char*) &table[0], table.size()*sizeof(grt_model_section));
+      for (size_t i=0; i<names.size(); i++) {
+        out.write(zeros, table[i].offset - pos);
+        out.write(contents[i].data(), contents[i].size());
+        pos = table[i].offset + contents[i].size();
+      }
+      out.write(zeros, h.length - pos);
+
+      return out.good();
+    }
+
+  protected:
+    std::vector<std::string> names, contents;
+
+    static uint64_t align(uint64_t n) { return (n+7) & ~((uint64_t)7); }
+};
+
+/* An array of a compiled model, either built by compiling a classifier or a
+ * view of a section of a binary model. Views point into the model's memory
+ * and keep it alive. Arrays are not copied, since views of the elements
+ * would then point into the original. */
+template <typename T>
+class ModelArray {
+  public:
+    ModelArray() : first(NULL), n(0) {}
+
+    /* takes over the contents of v */
+    void assign(std::vector<T> &v) {
+      owned.swap(v);
+      first = owned.empty() ? NULL : &owned[0];
+      n = owned.size();
+      keep.reset();
+    }
+
+    /* false if there is no such section or its length does not fit */
+    bool view(const BinaryModel &model, const std::string &name) {
+      const char *b, *e;
+      if (!model.section(name, b, e) || (e-b) % sizeof(T) != 0 ||
+          (uintptr_t) b % alignof(T) != 0)
+        return false;
+      std::vector<T>().swap(owned);
+      first = (const T*) b;
+      n = (e-b) / sizeof(T);
+      keep = model.keep();
+      return true;
+    }
+
+    void save(BinaryModelWriter &model, const std::string &name) const {
+      model.add(name, first, n * sizeof(T));
+    }
+
+    const T& operator[](size_t i) const { return first[i]; }
+    const T* data() const { return first; }
+    size_t size() const { return n; }
+    bool empty() const { return n == 0; }
+
+  protected:
+    std::vector<T> owned;
+    const T *first;
+    size_t n;
+    std::shared_ptr<const void> keep;
+
+    ModelArray(const ModelArray&);
+    ModelArray& operator=(const ModelArray&);
+};
+
+/* an input stream buffer reading a memory range in place */
+class MemoryBuffer : public std::streambuf {
+  public:
+    MemoryBuffer(const char *begin, const char *end) {
+      setg((char*) begin, (char*) begin, (char*) end);
+    }
+};
+
+#endif
@@ -0,0 +1,252 @@
+#ifndef _MODELWATCH_H_
+#define _MODELWATCH_H_
+
+#include "libgrt_util.h"
+#include "forest.h"
+#include "knn.h"
+#include "dtw.h"
+#include "quantized.h"
+#include <memory>
+#include <poll.h>
+#include <libgen.h>
+#include <sys/inotify.h>
+
+/* Notifies about files that have been written completely, i.e. closed after
+ * writing or renamed into place. The directory of each file is watched, so
+ * files that do not exist yet or are replaced by a rename are seen, too. */
+class FileWatch {
+  public:
+    FileWatch() : fd(inotify_init1(IN_CLOEXEC)) {}
+    ~FileWatch() { if (fd >= 0) close(fd); }
+
+    /* false if inotify is not available */
+    bool good() const { return fd >= 0; }
+
+    bool add(const string &filename) {
+      vector<char> d(filename.begin(), filename.end()), b = d;
+      d.push_back(0); b.push_back(0);
+
+      int wd = fd < 0 ? -1 : inotify_add_watch(fd, dirname(&d[0]),
+        IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MODIFY);
+      if (wd < 0)
+        return false;
+
+      Entry e = { wd, basename(&b[0]), filename };
+      entries.push_back(e);
+      return true;
+    }
+
+    /* Waits up to timeout milliseconds (-1 for no limit) for events on the
+     * watched files. Files that have been written completely are added to
+     * written. Returns false on timeout or error, true if any of the files
+     * has been touched at all. */
+    bool wait(int timeout, vector<string> &written) {
+      struct pollfd p = { fd, POLLIN, 0 };
+      bool touched = false;
+
+      while (!touched) {
+        int r = poll(&p, 1, timeout);
+        if (r < 0 && errno == EINTR)
+          continue;
+        if (r <= 0)
+          return false;
+
+        char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0)
+          return false;
+
+        for (char *ptr = buf; ptr < buf + n; ) {
+          struct inotify_event *ev = (struct inotify_event*) ptr;
+          ptr += sizeof(struct inotify_event) + ev->len;
+
+          for (auto &e : entries) {
+            if (ev->len == 0 || e.wd != ev->wd || e.name != ev->name)
+              continue;
+            touched = true;
+            if ((ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) &&
+                find(written.begin(), written.end(), e.path) == written.end())
+              written.push_back(e.path);
+          }
+        }
+      }
+
+      return true;
+    }
+
+  protected:
+    struct Entry { int wd; string name, path; };
+    int fd;
+    vector<Entry> entries;
+};
+
+/* Loads a model, waiting for it to be written if necessary, as happens when
+ * training and prediction are started at the same time. The file is loaded
+ * again each time it has been written, until it has not been touched for
+ * timeout seconds, so a file that never appears, e.g. for a mistyped name,
+ * is given up on as well. */
+static Classifier *loadClassifierWhenWritten(const string &filename, ModelHeader *header=NULL,
+                                             int timeout=65)
+{
+  FileWatch watch;
+  bool watched = watch.add(filename);
+
+  Classifier *classifier = loadClassifierFromFile(filename, header);
+
+  /* without inotify, or if the directory can not be watched, e.g. since it
+   * does not exist, fall back to polling */
+  auto until = chrono::steady_clock::now() + chrono::seconds(timeout);
+  while (!watched && classifier == NULL && chrono::steady_clock::now() < until) {
+    usleep(10000);
+    classifier = loadClassifierFromFile(filename, header);
+  }
+
+  while (classifier == NULL && watched) {
+    vector<string> written;
+
+    if (!watch.wait(timeout*1000, written))
+      break;
+    if (written.size() > 0)
+      classifier = loadClassifierFromFile(filename, header);
+  }
+
+  return classifier;
+}
+
+/* returns NULL for classifiers that are only predicted by GRT, or for all
+ * of them if $GRT_COMPILED is 0, e.g. to compare both. The compiled form
+ * stored with a binary model is opened rather than compiled again. */
+static CompiledModel *compileClassifier(Classifier *classifier, const ModelHeader &h = ModelHeader())
+{
+  const char *env = getenv("GRT_COMPILED");
+  if (env && strcmp(env, "0") == 0)
+    return NULL;
+
+  CompiledModel *m = NULL;
+  if (h.sections) m = FlatForest::open(*h.sections, classifier);
+  if (h.sections && m == NULL) m = KnnIndex::open(*h.sections, classifier);
+  if (m != NULL)
+    return m;
+
+  m = FlatForest::compile(classifier);
+  if (m == NULL) m = KnnIndex::compile(classifier);
+  if (m == NULL) m = DtwSearch::compile(classifier);
+  return m;
+}
+
+/* one loaded version of a model, copied for each of its users, and its
+ * compiled and quantized forms if it has them, which are shared since they
+ * are read-only */
+struct ModelVersion {
+  vector<Classifier*> copies;
+  CompiledModel *compiled, *quantized;
+
+  ModelVersion() : compiled(NULL), quantized(NULL) {}
+  ~ModelVersion() {
+    for (auto c : copies) delete c;
+    delete compiled;
+    delete quantized;
+  }
+};
+
+/* A model file that is loaded again whenever it has been rewritten. The new
+ * version is loaded on a background thread while the previous one is still
+ * in use. Users take the current version and switch to a newer one at a
+ * point of their choosing, e.g. between two segments. A version is freed
+ * once nobody uses it anymore. Objects of this class must live as long as
+ * the process, since the thread is never stopped. */
+class ReloadingModel {
+  public:
+    ReloadingModel(const string &filename, size_t ncopies, bool verbose=false)
+      : filename(filename), ncopies(std::max(ncopies, (size_t) 1)), verbose(verbose), quantizing(false) {}
+
+    /* also quantize each version, before loading the first one */
+    void quantize(QuantizedModel::Precision p) {
+      quantizing = true;
+      precision = p;
+    }
+
+    /* takes ownership of an already loaded classifier as first version,
+     * h is the header it was loaded with */
+    bool load(Classifier *classifier, const ModelHeader &h = ModelHeader()) {
+      ModelVersion *v = copy(classifier, h);
+      if (v == NULL)
+        return false;
+      lock_guard<mutex> l(lock);
+      version.reset(v);
+      return true;
+    }
+
+    bool watch() {
+      if (!files.add(filename))
+        return false;
+      thread(&ReloadingModel::run, this).detach();
+      return true;
+    }
+
+    shared_ptr<ModelVersion> current() {
+      lock_guard<mutex> l(lock);
+      return version;
+    }
+
+  protected:
+    string filename;
+    size_t ncopies;
+    bool verbose, quantizing;
+    QuantizedModel::Precision precision;
+    FileWatch files;
+    mutex lock;
+    shared_ptr<ModelVersion> version;
+
+    ModelVersion *copy(Classifier *classifier, const ModelHeader &h) {
+      ModelVersion *v = new ModelVersion;
+      v->copies.push_back(classifier);
+      for (size_t i=1; i<ncopies; i++) {
+        Classifier *c = classifier->deepCopy();
+        if (c == NULL) {
+          delete v;
+          return NULL;
+        }
+        v->copies.push_back(c);
+      }
+      v->compiled = compileClassifier(classifier, h);
+      if (quantizing)
+        v->quantized = QuantizedModel::compile(classifier, precision);
+      return v;
+    }
+
+    void run() {
+      for (;;) {
+        vector<string> written;
+        if (!files.wait(-1, written))
+          return;
+        if (written.empty())
+          continue;
+
+        ModelHeader h;
+        Classifier *next = loadClassifierFromFile(filename, &h), *previous = current()->copies[0];
+        if (next == NULL) {
+          cerr << filename << ": unable to load the rewritten model, keeping the previous one" << endl;
+          continue;
+        }
+
+        /* the input is parsed according to the model loaded first */
+        if (next->getTimeseriesCompatible() != previous->getTimeseriesCompatible() ||
+            next->getNumInputDimensions() != previous->getNumInputDimensions()) {
+          cerr << filename << ": the rewritten model expects different input, keeping the previous one" << endl;
+          delete next;
+          continue;
+        }
+
+        if (!load(next, h)) {
+          cerr << filename << ": unable to copy the rewritten model" << endl;
+          continue;
+        }
+
+        if (verbose)
+          cerr << filename << ": model reloaded" << endl;
+      }
+    }
+};
+
+#endif
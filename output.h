@@ -0,0 +1,206 @@
+#ifndef _OUTPUT_H_
+#define _OUTPUT_H_
+
+#include <iostream>
+#include <streambuf>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <unistd.h>
+
+static bool write_all(int fd, const char *data, size_t n) {
+  while (n > 0) {
+    ssize_t w = write(fd, data, n);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w <= 0)
+      return false;
+    data += w;
+    n -= w;
+  }
+  return true;
+}
+
+/* Writes the shortest decimal that reads back as v to s, which must hold
+ * 32 bytes, and returns its length. Values within [1e-4,1e15) are tried
+ * with as few decimals as possible: the candidate with k decimals is m/10^k
+ * for an integer m, which, like strtod, is correctly rounded, so it reads
+ * back as v exactly if the division gives v. Everything else is printed by
+ * the shortest of %.15g, %.16g and %.17g that reads back. Single precision
+ * values only need to read back as the same float. */
+static inline size_t format_double(char *s, double v, bool single = false) {
+  static const double pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19 };
+  double a = std::fabs(v);
+
+  if (!single && a >= 1e-4 && a < 1e15)
+    for (int k=0; k<20; k++) {
+      double scaled = a * pow10[k];
+      if (scaled >= 1125899906842624.) // 2^50, m is then the nearest integer
+        break;
+
+      uint64_t m = (uint64_t) (scaled + .5);
+      if ((double) m / pow10[k] != a)
+        continue;
+
+      char digits[24];
+      int nd = 0;
+      size_t n = 0;
+      do { digits[nd++] = '0' + m % 10; m /= 10; } while (m);
+      while (nd <= k) digits[nd++] = '0';
+
+      if (v < 0) s[n++] = '-';
+      for (int i=nd-1; i>=0; i--) {
+        s[n++] = digits[i];
+        if (i == k && k > 0) s[n++] = '.';
+      }
+      s[n] = 0;
+      return n;
+    }
+
+  static const int single_precision[] = { 6, 7, 8, 9 }, double_precision[] = { 15, 16, 17 };
+  const int *p   = single ? single_precision : double_precision,
+            *end = single ? single_precision + 4 : double_precision + 3;
+  int n = 0;
+
+  for (; p < end; p++) {
+    n = snprintf(s, 32, "%.*g", *p, v);
+    double r = strtod(s, NULL);
+    if (single ? (float) r == (float) v : r == v)
+      break;
+  }
+
+  return n;
+}
+
+/* a double printed with format_double() when written to a stream */
+struct Shortest { double value; };
+static inline Shortest shortest(double v) { Shortest s = { v }; return s; }
+
+static inline std::ostream& operator<<(std::ostream &out, Shortest v) {
+  char s[32];
+  return out.write(s, format_double(s, v.value));
+}
+
+/* An output stream buffer for results written line by line. Flushing the
+ * stream, e.g. with endl, only hands the line over. A writer thread writes
+ * once size bytes have piled up, or latency seconds after the oldest line
+ * that has not been written, so a stream that is read interactively still
+ * sees every line in time while a fast one is written in large blocks. A
+ * latency of zero writes on every flush. */
+class OutputBuffer : public std::streambuf {
+  public:
+    OutputBuffer(int fd, size_t size = 1<<16, double latency = .01)
+      : fd(fd), size(size), latency(latency), failed(false), stopping(false), buf(1<<12) {
+      setp(&buf[0], &buf[0] + buf.size());
+      if (latency > 0)
+        writer = std::thread(&OutputBuffer::run, this);
+    }
+
+    ~OutputBuffer() { close(); }
+
+    /* writes everything that is left, returns false if writing failed */
+    bool close() {
+      sync();
+      if (writer.joinable()) {
+        { std::lock_guard<std::mutex> lock(mutex);
+          stopping = true; }
+        ready.notify_one();
+        writer.join();
+      }
+      return !failed;
+    }
+
+  protected:
+    typedef std::chrono::steady_clock clock;
+
+    int fd;
+    size_t size;
+    double latency;
+    std::atomic<bool> failed;
+    bool stopping;
+    std::vector<char> buf, pending;
+    clock::time_point since;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::thread writer;
+
+    int overflow(int c) {
+      if (sync() != 0)
+        return traits_type::eof();
+      if (c != traits_type::eof()) {
+        *pptr() = c;
+        pbump(1);
+      }
+      return traits_type::not_eof(c);
+    }
+
+    int sync() {
+      size_t n = pptr() - pbase();
+      setp(&buf[0], &buf[0] + buf.size());
+
+      if (!writer.joinable())
+        return failed || (n > 0 && !write_all(fd, &buf[0], n)) ? (failed = true, -1) : 0;
+
+      if (n == 0)
+        return failed ? -1 : 0;
+
+      /* the writer waits for a first line, or for enough of them */
+      bool wake;
+      { std::lock_guard<std::mutex> lock(mutex);
+        wake = pending.empty() || (pending.size() < size && pending.size() + n >= size);
+        if (pending.empty())
+          since = clock::now();
+        pending.insert(pending.end(), &buf[0], &buf[0] + n); }
+
+      if (wake)
+        ready.notify_one();
+      return failed ? -1 : 0;
+    }
+
+    void run() {
+      std::vector<char> out;
+      std::unique_lock<std::mutex> lock(mutex);
+      auto deadline = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(latency));
+
+      while (!stopping || !pending.empty()) {
+        if (pending.empty())
+          ready.wait(lock);
+        else if (!stopping && pending.size() < size && clock::now() < since + deadline)
+          ready.wait_until(lock, since + deadline);
+        else {
+          out.swap(pending);
+          lock.unlock();
+          if (!write_all(fd, &out[0], out.size()))
+            failed = true;
+          out.clear();
+          lock.lock();
+        }
+      }
+    }
+};
+
+/* Sends cout through an OutputBuffer on stdout until the program exits.
+ * GRT_OUTPUT_BUFFER sets the number of bytes written at once and
+ * GRT_OUTPUT_LATENCY the time in milliseconds a line may be held back. */
+static void buffer_stdout() {
+  const char *size = getenv("GRT_OUTPUT_BUFFER"), *latency = getenv("GRT_OUTPUT_LATENCY");
+
+  static OutputBuffer out(1, size && *size ? strtoul(size, NULL, 10) : 1<<16,
+                          latency && *latency ? strtod(latency, NULL) / 1000. : .01);
+  static struct Restore {
+    std::streambuf *original;
+    ~Restore() { std::cout.flush(); std::cout.rdbuf(original); }
+  } restore = { std::cout.rdbuf(&out) };
+}
+
+#endif
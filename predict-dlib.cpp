@@ -2,6 +2,7 @@
 #include <stdio.h>
 
 #include "cmdline.h"
+#include "labelset.h"
 #include "dlib_trainers.h"
 
 using namespace std;
@@ -76,8 +77,8 @@ int main(int argc, char *argv[])
 
   /* read samples */
   std::vector<sample_type> samples;
-  std::vector<string> labels;
-  std::set<string> u_labels;
+  std::vector<uint32_t> labels;
+  LabelSet labelset;
 
   string line, label;
 
@@ -104,8 +105,7 @@ int main(int argc, char *argv[])
       continue;
 
     samples.push_back(mat(sample));
-    labels.push_back(label);
-    u_labels.insert(label);
+    labels.push_back(labelset.intern(label));
   }
 
 
@@ -115,7 +115,7 @@ int main(int argc, char *argv[])
    */
 
   for (size_t i = 0; i < samples.size(); ++i)
-    cout << labels[i] << "\t" << df(samples[i]) << endl;
+    cout << labelset[labels[i]] << "\t" << df(samples[i]) << endl;
 
 
   cout << endl;
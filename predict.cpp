@@ -1,5 +1,10 @@
 #include "libgrt_util.h"
 #include "cmdline.h"
+#include "predict.h"
+#include "socket.h"
+#include "modelwatch.h"
+
+int predict_remote(cmdline::parser &c);
 
 int main(int argc, char *argv[]) 
 {
@@ -10,7 +15,15 @@ int main(int argc, char *argv[])
   c.add        ("help",       'h', "print this message");
   c.add        ("likelihood", 'l', "print label_prediction likelihood instead of label and prediction");
   c.add        ("null",       'n', "draw labels randomly from the set of labels (for testing the chain)");
-  c.footer     ("[classifier-model-file] [filename]...");
+  c.add<int>   ("threads",    'j', "number of threads to predict with, 0 uses all cores", false, 1);
+  c.add<int>   ("batch",      'b', "number of samples read and predicted at once when using multiple threads", false, 4096);
+  c.add<int>   ("window",     'w', "predict the last number of frames of a stream of frames as timeseries, 0 disables", false, 0);
+  c.add<int>   ("hop",        'H', "number of frames between two predicted windows", false, 1);
+  c.add<string>("quantize",   'q', "predict with float32 or int8 weights where the model allows, none for full precision", false, "none", cmdline::oneof<string>("none", "float32", "int8"));
+  c.add        ("report",     'r', "compare the quantized with the full precision models on labelled input instead of predicting");
+  c.add        ("connect",    'c', "send the input to a model loaded by grt serve instead of loading it");
+  c.add<string>("socket",     's', "socket of the grt serve process", false, default_socket());
+  c.footer     ("[classifier-model-file]... [filename]");
 
   /* parse the classifier-common arguments */
   if (!c.parse(argc,argv,true) || c.exist("help")) {
@@ -20,81 +33,260 @@ int main(int argc, char *argv[])
 
   set_verbosity(c.get<int>("verbose"));
 
+  /* with more than two arguments, all but the last one are models */
+  vector<string> files = c.rest();
+  size_t nmodels = files.size() > 2 ? files.size() - 1 : 1;
+
+  if (c.get<int>("window") < 0 || c.get<int>("hop") < 1) {
+    cerr << "window must not be negative and hop must be at least one frame" << endl;
+    return -1;
+  }
+
+  if (c.exist("connect") && (c.get<int>("window") > 0 || nmodels > 1)) {
+    cerr << "windows and several models are not supported with --connect" << endl;
+    return -1;
+  }
+
+  if (c.get<int>("window") > 0 && nmodels > 1) {
+    cerr << "windows can only be predicted with a single model" << endl;
+    return -1;
+  }
+
+  bool quantize = c.get<string>("quantize") != "none", report = c.exist("report");
+
+  if (c.exist("connect") && quantize) {
+    cerr << "quantized models are not supported with --connect" << endl;
+    return -1;
+  }
+
+  if (report && (!quantize || c.get<int>("window") > 0)) {
+    cerr << "--report needs --quantize and can not be used with windows" << endl;
+    return -1;
+  }
+
+  if (c.exist("connect"))
+    return predict_remote(c);
+
+  buffer_stdout();
+
   /* wait until first data has arrived before trying to read the
    * classifier, to catch cases where the training has not yet been
    * completed, and he classifier has not yet been written to disk */
-  istream &in = grt_fileinput(c,1);
+  LineReader &in = grt_lineinput(c,nmodels);
   in.peek(); // block until data there
 
-  /* load a classification model */
-  ifstream fin; fin.open(c.rest().size() ? c.rest()[0] : "");
-  istream &model = c.rest().size() ? fin : cin;
+  /* load the classification models */
+  vector<Classifier*> classifiers;
+  vector<ModelHeader> headers(nmodels);
+  for (size_t i=0; i<nmodels; i++) {
+    Classifier *classifier = files.size() ?
+      loadClassifierFromFile(files[i], &headers[i]) : loadClassifierFromFile(cin, &headers[i]);
 
-  /* read and predict on input */
-  Classifier *classifier = loadClassifierFromFile(model);
+    if (classifier == NULL && files.size() > 0)
+      classifier = loadClassifierWhenWritten(files[i], &headers[i]);
 
-  if (classifier == NULL && c.rest().size() > 0)
-    for (int i=0; i<255*255 && classifier==NULL; i++, usleep(10*100)) {
-      ifstream fin(c.rest()[0]);
-      classifier = loadClassifierFromFile(fin);
+    if (classifier == NULL) {
+      cerr << "unable to load classification model " << (files.size() ? files[i] : "") << " giving up" << endl;
+      return -1;
     }
 
-  if (classifier == NULL) {
-    cerr << "unable to load classification model giving up" << endl;
+    if (i > 0 && classifier->getTimeseriesCompatible() != classifiers[0]->getTimeseriesCompatible()) {
+      cerr << files[i] << " and " << files[0] << " do not predict the same kind of input" << endl;
+      return -1;
+    }
+
+    classifiers.push_back(classifier);
+  }
+
+  /* prepare input, windows are made up of frames read one per line */
+  size_t window = c.get<int>("window");
+  if (window > 0 && !classifiers[0]->getTimeseriesCompatible()) {
+    cerr << classifiers[0]->getClassifierType() << " does not predict timeseries, windows can not be used" << endl;
     return -1;
   }
 
-  /* prepare input */
-  string data_type = classifier->getTimeseriesCompatible() ? "timeseries" : "classification";
+  string data_type = classifiers[0]->getTimeseriesCompatible() && window == 0 ? "timeseries" : "classification";
   CsvIOSample io(data_type);
 
-  while( in >> io && is_running ) {
-    UINT prediction = 0, label = 0;
-    string s_prediction, s_label;
-    bool result = false;
-
-    switch(io.type) {
-    case TIMESERIES:
-      result = classifier->predict(io.t_data.getData());
-      label = io.t_data.getClassLabel();
-      s_label = classifier->getClassNameForLabel(label);
-      prediction = classifier->getPredictedClassLabel();
-      s_prediction = classifier->getClassNameForLabel(prediction);
-      break;
-    case CLASSIFICATION:
-      result = classifier->predict(io.c_data.getSample());
-      label = io.c_data.getClassLabel();
-      s_label = classifier->getClassNameForLabel(label);
-      prediction   = classifier->getPredictedClassLabel();
-      s_prediction = classifier->getClassNameForLabel(prediction);
-      break;
-    default:
-      cerr << "unknown input type" << endl;
-      return -1;
+  /* one copy of each classifier per thread, stateful ones stay serial.
+   * Several models share the threads and predict at the same time. */
+  int threads = c.get<int>("threads");
+  if (threads <= 0)
+    threads = thread::hardware_concurrency();
+
+  vector<ReloadingModel*> models;
+  vector< shared_ptr<ModelVersion> > versions;
+  vector<Predictor> predictors, exact;
+  vector<ModelUpdate> updates(nmodels);
+  int workers = 0;
+
+  for (size_t i=0; i<nmodels; i++) {
+    Classifier *classifier = classifiers[i];
+    int copies = std::max(threads / (int) nmodels, 1);
+
+    if (copies > 1 && is_stateful(classifier)) {
+      if (c.get<int>("verbose") > 0)
+        cerr << classifier->getClassifierType() << " depends on the order of samples, predicting on a single thread" << endl;
+      copies = 1;
     }
+    workers += copies;
 
-    if (!result) {
-      cerr << "prediction failed (wrong input type?)" << endl;
+    /* a model file that is rewritten while predicting is loaded again and
+     * used from the next sample on */
+    ReloadingModel *model = new ReloadingModel(files.size() ? files[i] : "-",
+                                               copies, c.get<int>("verbose") > 0);
+    if (quantize)
+      model->quantize(c.get<string>("quantize") == "int8" ? QuantizedModel::INT8 : QuantizedModel::FLOAT32);
+    if (!model->load(classifier, headers[i])) {
+      cerr << "unable to copy the classifier for " << copies << " threads" << endl;
       return -1;
     }
 
-    if (label == 0) s_label = "NULL";
-    if (prediction == 0) s_prediction = "NULL";
+    models.push_back(model);
+    versions.push_back(model->current());
+    predictors.push_back(Predictor(versions[i]->copies, versions[i]->quantized ? versions[i]->quantized : versions[i]->compiled));
+    exact.push_back(Predictor(versions[i]->copies, versions[i]->compiled));
+
+    if (quantize && versions[i]->quantized == NULL)
+      cerr << classifier->getClassifierType() << " can not be quantized, predicting in full precision" << endl;
+
+    if (files.size() > 0 && model->watch())
+      updates[i] = [&versions, model, i](Predictor &p) {
+        shared_ptr<ModelVersion> latest = model->current();
+        if (latest == versions[i])
+          return false;
+        versions[i] = latest;
+        p = Predictor(latest->copies, latest->quantized ? latest->quantized : latest->compiled);
+        return true;
+      };
+  }
+
+  /* samples are read in batches and printed in input order once the whole
+   * batch has been predicted. Predicting serially uses batches of one so no
+   * input is held back. */
+  PredictOptions opt;
+  opt.batch      = threads > 1 && workers > 1 ? std::max(c.get<int>("batch"), 1) : 1;
+  opt.likelihood = c.exist("likelihood");
+  opt.null       = c.exist("null");
+  opt.window     = window;
+  opt.hop        = c.get<int>("hop");
+  opt.parallel   = threads > 1 && workers > 1;
+
+  /* the report reads the input once, predicting each batch both ways */
+  if (report) {
+    vector<string> names;
+    for (size_t i=0; i<nmodels; i++)
+      names.push_back(files.size() ? files[i] : "-");
 
-    /*
-     * replace the prediction with a random choice from the labelset
-     */
-    if (c.exist("null")) {
-      UINT index = (UINT) round(drand48() * (classifier->getNumClasses()-1));
-      s_prediction = index == 0 ? "NULL" : classifier->getClassNameForLabel(index);
+    string error;
+    if (data_type == "timeseries" || !predict_report(exact, predictors, names, in, io, cout, opt, error, &is_running)) {
+      cerr << (error.empty() ? "quantized models only predict samples, not timeseries" : error) << endl;
+      return -1;
     }
+    return 0;
+  }
 
-    if (c.exist("likelihood"))
-      cout << s_label << "\t" << s_prediction << "\t" << classifier->getMaximumLikelihood() << endl;
-    else
-      cout << s_label << "\t" << s_prediction << endl;
+  /* name the prediction columns of several models for grt score */
+  if (nmodels > 1) {
+    cout << "# label";
+    for (size_t i=0; i<nmodels; i++)
+      cout << "\t" << files[i] << (opt.likelihood ? "\tlikelihood" : "");
+    cout << endl;
+  }
+
+  string error;
+  bool ok = window > 0 ?
+    predict_windows(predictors[0], in, io, cout, opt, error, &is_running, updates[0]) :
+    predict_stream(predictors, in, io, cout, opt, error, &is_running, updates);
+
+  if (!ok) {
+    cerr << error << endl;
+    return -1;
   }
 
   cout << endl;
   return 0;
 }
+
+/* Sends the input to grt serve and copies its answer to stdout. The input
+ * is passed on unparsed, so text as well as binary datasets work. Sending
+ * happens on a second thread, since the server may answer before all of
+ * the input has been sent. */
+int predict_remote(cmdline::parser &c)
+{
+  string path = c.get<string>("socket"), status;
+  string model = c.rest().size() > 0 ? c.rest()[0] : "-";
+  int in = 0, fd = unix_connect(path);
+
+  signal(SIGPIPE, SIG_IGN);
+
+  if (fd < 0) {
+    cerr << "unable to connect to " << path << ": " << strerror(errno) << endl;
+    return -1;
+  }
+
+  if (c.rest().size() > 1 && c.rest()[1] != "-" &&
+      (in = open(c.rest()[1].c_str(), O_RDONLY | O_CLOEXEC)) < 0) {
+    cerr << "unable to open file: " << c.rest()[1] << endl;
+    return -1;
+  }
+
+  string request = "predict " + model +
+    (c.exist("likelihood") ? " likelihood" : "") +
+    (c.exist("null") ? " null" : "") + "\n";
+
+  if (!write_all(fd, request.data(), request.size())) {
+    cerr << "unable to send request to " << path << endl;
+    return -1;
+  }
+
+  thread sender([&]() {
+    vector<char> buf(1<<16);
+    ssize_t n;
+    while ((n = read(in, &buf[0], buf.size())) > 0 || (n < 0 && errno == EINTR))
+      if (n > 0 && !write_all(fd, &buf[0], n))
+        break;
+    shutdown(fd, SHUT_WR);
+  });
+
+  /* output lines are passed on as they arrive, up to the line without a
+   * tab that tells how the prediction ended */
+  bool ok = read_line(fd, status) && status == "ok";
+  string pending;
+  vector<char> buf(1<<16);
+  ssize_t n;
+
+  while (ok && ((n = read(fd, &buf[0], buf.size())) > 0 || (n < 0 && errno == EINTR))) {
+    pending.append(&buf[0], std::max(n, (ssize_t) 0));
+    size_t done = 0, eol;
+
+    while (status == "ok" && (eol = pending.find('\n', done)) != string::npos) {
+      if (pending.find('\t', done) < eol)
+        done = eol + 1;
+      else
+        status = pending.substr(done, eol - done);
+    }
+
+    if (!write_all(1, pending.data(), done))
+      break;
+    pending.erase(0, done);
+    if (status != "ok")
+      break;
+  }
+
+  if (status == "end")
+    write_all(1, "\n", 1);
+  else {
+    cerr << (status.compare(0, 6, "error ") == 0 ? status.substr(6) :
+             status == "ok" ? "incomplete answer from " + path : "no answer from " + path) << endl;
+    ok = false;
+  }
+
+  /* The server only answers completely once it has read all of the input.
+   * If it stopped early, the sender might still wait for input, which is
+   * dropped then. */
+  shutdown(fd, SHUT_RDWR);
+  sender.detach();
+
+  return ok ? 0 : -1;
+}
@@ -0,0 +1,530 @@
+#ifndef _PREDICT_H_
+#define _PREDICT_H_
+
+#include "libgrt_util.h"
+#include "compiled.h"
+#include "quantized.h"
+#include <functional>
+#include <chrono>
+#include <memory>
+
+/* result of predicting one sample */
+struct Prediction {
+  bool  ok;
+  UINT  label;
+  Float likelihood;
+};
+
+/* What a stream is predicted with: the model, a copy of it for each further
+ * thread and the compiled form of the model if it has one. */
+struct Predictor {
+  vector<Classifier*> classifiers;
+  const CompiledModel *compiled;
+  size_t checked;  // samples of the compiled form compared to GRT so far
+
+  Predictor(const vector<Classifier*> &c = vector<Classifier*>(), const CompiledModel *m = NULL)
+    : classifiers(c), compiled(m), checked(0) {}
+};
+
+/* output options of grt predict */
+struct PredictOptions {
+  size_t batch;     // samples predicted at once, 1 prints every sample right away
+  bool likelihood;  // print the likelihood of each prediction
+  bool null;        // replace predictions by random labels
+  size_t window;    // frames per window, 0 to predict samples as read
+  size_t hop;       // frames between two windows
+  bool parallel;    // predict with several models at the same time
+};
+
+static Prediction predict_sample(Classifier *c, ClassificationSample &s) {
+  Prediction p = { c->predict(s.getSample()), c->getPredictedClassLabel(), c->getMaximumLikelihood() };
+  return p;
+}
+
+static Prediction predict_sample(Classifier *c, TimeSeriesClassificationSample &s) {
+  Prediction p = { c->predict(s.getData()), c->getPredictedClassLabel(), c->getMaximumLikelihood() };
+  return p;
+}
+
+/* Classifiers whose prediction depends on the samples predicted before, which
+ * makes the order of predictions matter. These are never run in parallel. */
+static bool is_stateful(Classifier *c) {
+  static const vector<string> stateful = { "HMM", "ParticleClassifier", "SwipeDetector" };
+  return find(stateful.begin(), stateful.end(), c->getClassifierType()) != stateful.end();
+}
+
+/* Predicts the first n samples of a batch, spread over one classifier per
+ * thread. With a single classifier everything is done on this thread. */
+template<class Sample>
+void predict_batch(Predictor &p, vector<Sample> &batch, size_t n, vector<Prediction> &results)
+{
+  vector<Classifier*> &classifiers = p.classifiers;
+
+  if (classifiers.size() == 1 || n == 1) {
+    for (size_t i=0; i<n; i++)
+      results[i] = predict_sample(classifiers[0], batch[i]);
+    return;
+  }
+
+  atomic<size_t> next(0);
+  vector<thread> pool;
+
+  for (size_t t=0; t<classifiers.size() && t<n; t++)
+    pool.push_back(thread([&,t]() {
+      for (size_t i; (i = next++) < n; )
+        results[i] = predict_sample(classifiers[t], batch[i]);
+    }));
+
+  for (auto &th : pool)
+    th.join();
+}
+
+/* Predicts with the compiled model, split into one range of samples per
+ * thread. Returns false if the compiled model could not predict them. */
+template<class Input>
+bool predict_compiled(Predictor &p, vector<Input*> &x, vector<Prediction> &results, bool likelihood)
+{
+  size_t n = x.size(), threads = std::min(p.classifiers.size(), (n + 255) / 256),
+         chunk = (n + threads - 1) / threads;
+  vector<UINT> labels(n);
+  vector<Float> likelihoods(n);
+  vector<char> ok(threads, true);
+  vector<thread> pool;
+
+  for (size_t t=1; t<threads; t++)
+    pool.push_back(thread([&,t]() {
+      size_t b = std::min(t*chunk, n), e = std::min(b+chunk, n);
+      ok[t] = p.compiled->predict(&x[b], e-b, &labels[b], likelihood ? &likelihoods[b] : NULL);
+    }));
+  ok[0] = p.compiled->predict(&x[0], std::min(chunk, n), &labels[0], likelihood ? &likelihoods[0] : NULL);
+
+  for (auto &th : pool)
+    th.join();
+
+  if (find(ok.begin(), ok.end(), false) != ok.end())
+    return false;
+
+  for (size_t i=0; i<n; i++) {
+    results[i].ok         = true;
+    results[i].label      = labels[i];
+    results[i].likelihood = likelihoods[i];
+  }
+
+  return true;
+}
+
+/* The first samples are also predicted by GRT. If any of them differs, the
+ * compiled model is not used anymore and false is returned. */
+template<class Sample>
+bool check_compiled(Predictor &p, vector<Sample> &batch, size_t n, vector<Prediction> &results, bool likelihood)
+{
+  static const size_t CHECK = 16;
+
+  if (!p.compiled->exact())
+    return true;
+
+  for (size_t i=0; i<n && p.checked < CHECK; i++, p.checked++) {
+    Prediction r = predict_sample(p.classifiers[0], batch[i]);
+    if (r.ok != results[i].ok || r.label != results[i].label ||
+        (likelihood && r.likelihood != results[i].likelihood)) {
+      cerr << "warning: the compiled model predicts differently than GRT, not using it" << endl;
+      p.compiled = NULL;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static void predict_batch(Predictor &p, vector<ClassificationSample> &batch, size_t n, vector<Prediction> &results)
+{
+  vector<VectorFloat*> x(n);
+  for (size_t i=0; i<n; i++)
+    x[i] = &batch[i].getSample();
+
+  if (p.compiled == NULL || !predict_compiled(p, x, results, true) ||
+      !check_compiled(p, batch, n, results, true))
+    predict_batch<ClassificationSample>(p, batch, n, results);
+}
+
+/* Some compiled models only find labels faster, without likelihoods. */
+static void predict_batch(Predictor &p, vector<TimeSeriesClassificationSample> &batch, size_t n,
+                          vector<Prediction> &results, bool likelihood)
+{
+  vector<MatrixFloat*> x(n);
+  for (size_t i=0; i<n; i++)
+    x[i] = &batch[i].getData();
+
+  if (p.compiled == NULL || !predict_compiled(p, x, results, likelihood) ||
+      !check_compiled(p, batch, n, results, likelihood))
+    predict_batch<TimeSeriesClassificationSample>(p, batch, n, results);
+}
+
+/* replaces the predictor by a newer version of the model, if there is one */
+typedef std::function<bool(Predictor&)> ModelUpdate;
+
+/* appends the predicted label of a model, and its likelihood if asked to,
+ * returns false if the prediction failed */
+static bool put_prediction(string &line, Classifier *classifier, const Prediction &result,
+                           const PredictOptions &opt)
+{
+  UINT prediction = result.label;
+  string s_prediction = classifier->getClassNameForLabel(prediction);
+
+  if (!result.ok)
+    return false;
+
+  if (prediction == 0) s_prediction = "NULL";
+
+  /*
+   * replace the prediction with a random choice from the labelset
+   */
+  if (opt.null) {
+    UINT index = (UINT) round(drand48() * (classifier->getNumClasses()-1));
+    s_prediction = index == 0 ? "NULL" : classifier->getClassNameForLabel(index);
+  }
+
+  line += "\t";
+  line += s_prediction;
+
+  if (opt.likelihood) {
+    char s[32];
+    line += "\t";
+    line.append(s, format_double(s, result.likelihood));
+  }
+
+  return true;
+}
+
+/* prints a line of label and predicted label, or false if the prediction failed */
+static bool print_prediction(ostream &out, CsvIOSample &io, Classifier *classifier, UINT label,
+                             const Prediction &result, const PredictOptions &opt)
+{
+  string line = label == 0 ? "NULL" : io.labelset[label];
+
+  if (!put_prediction(line, classifier, result, opt))
+    return false;
+
+  out << line << endl;
+  return true;
+}
+
+/* reading stops at a segment whose rows differ in length, which is reported
+ * as an error once the samples before it have been predicted */
+static bool parse_error(const CsvIOSample &io, string &error)
+{
+  if (io.errline == 0)
+    return false;
+  error = "number of dimensions changed in line " + to_string(io.errline);
+  return true;
+}
+
+/* Reads samples until the end of input (or until running turns false) and
+ * prints a line of label and the label predicted by each model for each of
+ * them, in input order. Each sample is parsed once for all models, which
+ * predict a batch at the same time if opt.parallel is set. Before each
+ * batch, the update of a model may switch it to another version, so a new
+ * model takes effect between two samples, i.e. at segment boundaries for
+ * timeseries. Returns false and sets error if the input could not be
+ * predicted. */
+static bool predict_stream(vector<Predictor> &predictors, LineReader &in, CsvIOSample &io,
+                           ostream &out, const PredictOptions &opt, string &error,
+                           const bool *running = NULL,
+                           const vector<ModelUpdate> &updates = vector<ModelUpdate>())
+{
+  size_t batch = std::max(opt.batch, (size_t) 1), models = predictors.size();
+  vector<ClassificationSample>           c_batch(batch);
+  vector<TimeSeriesClassificationSample> t_batch(batch);
+  vector<UINT>                           labels(batch);
+  vector< vector<Prediction> >           results(models, vector<Prediction>(batch));
+  string line;
+
+  while (running == NULL || *running) {
+    size_t n = 0;
+
+    for (; n < batch && in >> io; n++)
+      switch(io.type) {
+      case TIMESERIES:
+        labels[n]  = io.t_data.getClassLabel();
+        t_batch[n] = io.t_data;
+        break;
+      case CLASSIFICATION:
+        labels[n]  = io.c_data.getClassLabel();
+        c_batch[n] = io.c_data;
+        break;
+      default:
+        error = "unknown input type";
+        return false;
+      }
+
+    if (n == 0)
+      break;
+
+    auto predict = [&](size_t m) {
+      if (m < updates.size() && updates[m])
+        updates[m](predictors[m]);
+
+      if (io.type == TIMESERIES)
+        predict_batch(predictors[m], t_batch, n, results[m], opt.likelihood);
+      else
+        predict_batch(predictors[m], c_batch, n, results[m]);
+    };
+
+    if (opt.parallel && models > 1) {
+      vector<thread> pool;
+      for (size_t m=0; m<models; m++)
+        pool.push_back(thread(predict, m));
+      for (auto &t : pool)
+        t.join();
+    } else
+      for (size_t m=0; m<models; m++)
+        predict(m);
+
+    for (size_t i=0; i<n; i++) {
+      line = labels[i] == 0 ? "NULL" : io.labelset[labels[i]];
+
+      for (size_t m=0; m<models; m++)
+        if (!put_prediction(line, predictors[m].classifiers[0], results[m][i], opt)) {
+          error = "prediction failed (wrong input type?)";
+          return false;
+        }
+
+      out << line << endl;
+    }
+
+    if (parse_error(io, error))
+      return false;
+  }
+
+  return !parse_error(io, error);
+}
+
+static bool predict_stream(Predictor &predictor, LineReader &in, CsvIOSample &io,
+                           ostream &out, const PredictOptions &opt, string &error,
+                           const bool *running = NULL, ModelUpdate update = ModelUpdate())
+{
+  vector<Predictor> predictors(1, predictor);
+  bool ok = predict_stream(predictors, in, io, out, opt, error, running,
+                           vector<ModelUpdate>(1, update));
+  predictor = predictors[0];
+  return ok;
+}
+
+/* Predicts the input with the exact and the quantized form of each model,
+ * named by names[m], and prints a line per model of how often both agree,
+ * the accuracy of both and how much faster the quantized one is. Samples
+ * are read in batches of at least 4096 for timing. */
+static bool predict_report(vector<Predictor> &exact, vector<Predictor> &quantized,
+                           const vector<string> &names, LineReader &in, CsvIOSample &io,
+                           ostream &out, const PredictOptions &opt, string &error,
+                           const bool *running = NULL)
+{
+  typedef std::chrono::steady_clock clock;
+  size_t batch = std::max(opt.batch, (size_t) 4096), models = exact.size(), total = 0;
+  vector<ClassificationSample> c_batch(batch);
+  vector<Prediction>           a(batch), b(batch);
+  vector<size_t>               agree(models, 0), right(models, 0), qright(models, 0);
+  vector<double>               t_exact(models, 0), t_quantized(models, 0);
+
+  while (running == NULL || *running) {
+    size_t n = 0;
+
+    for (; n < batch && in >> io; n++) {
+      if (io.type != CLASSIFICATION) {
+        error = "quantized models only predict samples, not timeseries";
+        return false;
+      }
+      c_batch[n] = io.c_data;
+    }
+
+    if (n == 0)
+      break;
+
+    for (size_t m=0; m<models; m++) {
+      clock::time_point t0 = clock::now();
+      predict_batch(exact[m], c_batch, n, a);
+      clock::time_point t1 = clock::now();
+      predict_batch(quantized[m], c_batch, n, b);
+      clock::time_point t2 = clock::now();
+
+      t_exact[m]     += std::chrono::duration<double>(t1 - t0).count();
+      t_quantized[m] += std::chrono::duration<double>(t2 - t1).count();
+
+      for (size_t i=0; i<n; i++) {
+        UINT label = c_batch[i].getClassLabel();
+        agree[m]  += a[i].ok == b[i].ok && a[i].label == b[i].label;
+        right[m]  += a[i].ok && a[i].label == label;
+        qright[m] += b[i].ok && b[i].label == label;
+      }
+    }
+
+    total += n;
+  }
+
+  if (parse_error(io, error))
+    return false;
+
+  out << "# model\tprecision\tsamples\tagreement\taccuracy\tquantized\tdelta\tspeedup" << endl;
+  for (size_t m=0; m<models; m++) {
+    const QuantizedModel *q = dynamic_cast<const QuantizedModel*>(quantized[m].compiled);
+    double n = std::max(total, (size_t) 1);
+
+    out << names[m] << "\t" << (q ? q->name() : "none") << "\t" << total << "\t"
+        << shortest(agree[m] / n) << "\t" << shortest(right[m] / n) << "\t"
+        << shortest(qright[m] / n) << "\t" << shortest((qright[m] - (double) right[m]) / n) << "\t"
+        << shortest(t_quantized[m] > 0 ? t_exact[m] / t_quantized[m] : 1) << endl;
+  }
+
+  return true;
+}
+
+/* The last frames of a stream, i.e. rows read as classification samples. */
+class FrameWindow {
+  public:
+    FrameWindow(size_t size) : size(size), dims(0), head(0), count(0) {}
+
+    /* false if the frame has a different dimension than the ones before */
+    bool push(UINT label, const VectorFloat &frame) {
+      if (dims == 0) {
+        dims = frame.size();
+        frames.resize(size * dims);
+        labels.resize(size);
+      }
+
+      if (frame.size() != dims || dims == 0)
+        return false;
+
+      size_t slot = (head + count) % size;
+      if (count == size)
+        head = (head + 1) % size;
+      else
+        count++;
+
+      std::copy(frame.begin(), frame.end(), &frames[slot * dims]);
+      labels[slot] = label;
+      return true;
+    }
+
+    bool full() const { return count == size; }
+
+    /* frame i of the window, 0 being the oldest */
+    const Float *frame(size_t i) const { return &frames[((head + i) % size) * dims]; }
+
+    /* the window as timeseries, labelled like its last frame */
+    void sample(TimeSeriesClassificationSample &s) const {
+      MatrixFloat m(count, dims);
+      for (size_t i=0; i<count; i++)
+        std::copy(frame(i), frame(i) + dims, m[i]);
+      s.setTrainingSample(last(), m);
+    }
+
+    UINT last() const { return labels[(head + count - 1) % size]; }
+
+  protected:
+    size_t size, dims, head, count;
+    vector<Float> frames;
+    vector<UINT> labels;
+};
+
+/* Predicts the window of the last opt.window frames every opt.hop frames,
+ * once it is full, and prints it like a segment ending at the last frame.
+ * Unless likelihoods are printed, compiled models that keep the work done
+ * for a frame across windows are given every frame. Other models predict
+ * each window as a timeseries, batched like predict_stream does. */
+static bool predict_windows(Predictor &predictor, LineReader &in, CsvIOSample &io,
+                            ostream &out, const PredictOptions &opt, string &error,
+                            const bool *running = NULL, ModelUpdate update = ModelUpdate())
+{
+  static const size_t CHECK = 16;
+
+  Classifier *classifier = predictor.classifiers[0];
+  size_t batch = std::max(opt.batch, (size_t) 1), n = 0, since = opt.hop - 1;
+  FrameWindow window(opt.window);
+  vector<TimeSeriesClassificationSample> t_batch(batch);
+  vector<UINT>                           labels(batch);
+  vector<Prediction>                     results(batch);
+
+  auto sliding = [&]() -> SlidingWindow* {
+    if (predictor.compiled == NULL || opt.likelihood)
+      return NULL;
+    return predictor.compiled->window(opt.window);
+  };
+  unique_ptr<SlidingWindow> state(sliding());
+
+  auto flush = [&]() {
+    predict_batch(predictor, t_batch, n, results, opt.likelihood);
+    for (size_t i=0; i<n; i++)
+      if (!print_prediction(out, io, classifier, labels[i], results[i], opt)) {
+        error = "prediction failed (wrong input type?)";
+        return false;
+      }
+    n = 0;
+    return true;
+  };
+
+  while ((running == NULL || *running) && in >> io) {
+    if (io.type != CLASSIFICATION) {
+      error = "unknown input type";
+      return false;
+    }
+
+    if (!window.push(io.c_data.getClassLabel(), io.c_data.getSample())) {
+      error = "number of dimensions changed in line " + to_string(io.linenum);
+      return false;
+    }
+
+    if (state)
+      state->push(&io.c_data.getSample()[0]);
+
+    /* the first window is predicted as soon as it is full */
+    if (!window.full() || ++since < opt.hop)
+      continue;
+    since = 0;
+
+    /* a new model is given the frames of the current window */
+    if (update && update(predictor)) {
+      classifier = predictor.classifiers[0];
+      if (n > 0 && !flush())
+        return false;
+      state.reset(sliding());
+      for (size_t i=0; state && i<opt.window; i++)
+        state->push(window.frame(i));
+    }
+
+    /* windows the compiled model can not predict, e.g. with a NaN frame, are
+     * predicted by GRT, in order with the others */
+    if (state) {
+      Prediction r = { false, 0, 0 };
+      r.ok = state->predict(r.label);
+
+      if (r.ok && predictor.checked < CHECK) {
+        TimeSeriesClassificationSample s;
+        window.sample(s);
+        Prediction g = predict_sample(classifier, s);
+        predictor.checked++;
+        if (!g.ok || g.label != r.label) {
+          cerr << "warning: the compiled model predicts differently than GRT, not using it" << endl;
+          predictor.compiled = NULL;
+          state.reset();
+        }
+      }
+
+      if (r.ok && state) {
+        if ((n > 0 && !flush()) || !print_prediction(out, io, classifier, window.last(), r, opt)) {
+          error = "prediction failed (wrong input type?)";
+          return false;
+        }
+        continue;
+      }
+    }
+
+    window.sample(t_batch[n]);
+    labels[n++] = window.last();
+    if (n == batch && !flush())
+      return false;
+  }
+
+  return (n == 0 || flush()) && !parse_error(io, error);
+}
+
+#endif
@@ -2,6 +2,7 @@
 #include <iostream>
 #include "cmdline.h"
 #include "libgrt_util.h"
+#include "filters.h"
 
 using namespace GRT;
 using namespace std;
@@ -14,11 +15,276 @@ string list_preprocessors() {
 
   for( auto name : PreProcessing::getRegisteredPreprocessors() )
     ss << name << endl;
+  ss << "Resample" << endl;
 
   return ss.str();
 }
 
-PreProcessing *apply_cmdline_args(string, cmdline::parser&,int,string&);
+PreProcessing *apply_cmdline_args(const vector<string>&, cmdline::parser&,int,string&);
+Resampler *apply_resample_args(const vector<string>&, cmdline::parser&, string&);
+
+/* Splits the arguments into the stages of a chain, which are separated by
+ * a single "+", e.g. MedianFilter -F 5 + Derivative. The first argument of
+ * each stage is the name of its pre-processor. */
+vector< vector<string> > split_stages(const vector<string> &args) {
+  vector< vector<string> > stages(1);
+
+  for (auto &arg : args)
+    if (arg == "+")
+      stages.push_back(vector<string>());
+    else
+      stages.back().push_back(arg);
+
+  return stages;
+}
+
+/* Reads a chain from a file with one stage per line, written like on the
+ * command line. Empty lines and lines starting with # are skipped. */
+bool read_stages(const string &filename, vector< vector<string> > &stages) {
+  ifstream file(filename);
+  string line;
+
+  if (!file)
+    return false;
+
+  while (getline(file, line)) {
+    stringstream ss(line);
+    vector<string> stage;
+    string arg;
+
+    while (ss >> arg)
+      stage.push_back(arg);
+
+    if (stage.size() > 0 && stage[0][0] != '#')
+      stages.push_back(stage);
+  }
+
+  return true;
+}
+
+/* A pre-processor of the chain. Where a BlockFilter can take its place,
+ * both are run on the first frames, like compiled models are checked in
+ * grt predict, and the block filter is dropped should they differ. Resample
+ * is not a GRT pre-processor, since it changes the number of frames. */
+struct Stage {
+  static const size_t CHECK = 16;
+
+  string name;
+  PreProcessing *pp;
+  BlockFilter *block;
+  Resampler *resample;
+  size_t in, out, checked;
+  Float scale;  // largest value seen while checking
+};
+
+/* equal up to rounding relative to the values seen so far, since filters
+ * like FIR sum up many of them */
+static bool same_value(Float a, Float b, Float scale) {
+  return a == b || (std::isnan(a) && std::isnan(b)) || fabs(a - b) <= 1e-6 * scale;
+}
+
+/* Filters frames rows of s.in values each into rows of s.out values. Returns
+ * the number of frames done, which is less than frames if GRT failed. */
+static size_t run_stage(Stage &s, vector<Float> &data, vector<Float> &next, size_t frames) {
+  if (s.block && s.checked >= s.block->history() + Stage::CHECK) {
+    s.block->process(&data[0], frames);
+    return frames;
+  }
+
+  VectorFloat x(s.in);
+  next.resize(frames * s.out);
+  for (size_t f=0; f<frames; f++) {
+    std::copy(&data[f*s.in], &data[f*s.in] + s.in, x.begin());
+    if (!s.pp->process(x))
+      return f;
+    VectorFloat y = s.pp->getProcessedData();
+    if (y.size() != s.out)
+      return f;
+    std::copy(y.begin(), y.end(), &next[f*s.out]);
+
+    if (s.block)
+      for (size_t i=0; i<s.in; i++)
+        if (std::isfinite(x[i]) && std::isfinite(y[i]))
+          s.scale = std::max(s.scale, std::max(fabs(x[i]), fabs(y[i])));
+  }
+
+  /* the block filter's output is kept if it agrees, so that it does not
+   * matter which frames have been checked, e.g. on which thread */
+  if (s.block) {
+    s.block->process(&data[0], frames);
+    s.checked += frames;
+    for (size_t i=0; i<frames*s.out; i++)
+      if (!same_value(data[i], next[i], s.scale)) {
+        cerr << s.name << ": block filter differs from GRT, filtering frame by frame" << endl;
+        delete s.block;
+        s.block = NULL;
+        break;
+      }
+  }
+
+  if (!s.block)
+    data.swap(next);
+  return frames;
+}
+
+/* Builds the stages, exiting with a message if one can not be built. Only
+ * the last stage may be followed by an input file. */
+static vector<Stage> build_chain(const vector< vector<string> > &stages, cmdline::parser &c, string &input_file) {
+  vector<Stage> chain;
+
+  for (size_t i=0; i<stages.size(); i++) {
+    string rest = "";
+
+    if (stages[i].empty()) {
+      cerr << c.usage() << endl << "missing pre-processor after +" << endl;
+      exit(-1);
+    }
+
+    string &file = i+1 < stages.size() ? rest : input_file;
+    Resampler *resample = NULL;
+    PreProcessing *pp = NULL;
+
+    if (stages[i][0] == "Resample")
+      resample = apply_resample_args(stages[i],c,file);
+    else
+      pp = apply_cmdline_args(stages[i],c,1,file);
+
+    if (pp==NULL && resample==NULL)
+      exit(-1);
+
+    if (rest != "") {
+      cerr << "unexpected argument " << rest << " for " << stages[i][0] << endl;
+      exit(-1);
+    }
+
+    Stage stage = { stages[i][0], pp, NULL, resample, 0, 0, 0, 0 };
+    chain.push_back(stage);
+  }
+
+  return chain;
+}
+
+/* Sets up the stages for frames of dims values, each one with the output
+ * dimension of the one before. */
+static void init_chain(vector<Stage> &chain, size_t dims, size_t block) {
+  for (auto &stage : chain) {
+    if (stage.resample) {
+      stage.in = stage.out = dims;
+      stage.resample->init(dims);
+      continue;
+    }
+
+    // weird stuff, pp resets only when initialized, it only initialized once
+    // data has been seen, and only set num outputdimenstion when reset so:
+    stage.in = dims;
+    stage.pp->setNumInputDimensions(dims);
+    stage.pp->process(VectorFloat(dims, 1.));
+    stage.pp->reset();
+    stage.out = dims = stage.pp->getNumOutputDimensions();
+    if (stage.out == stage.in)
+      stage.block = compileFilter(stage.pp, stage.in, block);
+  }
+}
+
+static void reset_chain(vector<Stage> &chain) {
+  for (auto &stage : chain) {
+    if (stage.pp)
+      stage.pp->reset();
+    if (stage.block)
+      stage.block->reset();
+    if (stage.resample)
+      stage.resample->reset();
+  }
+}
+
+/* Lines read at once, with the frame of each, or NONE for comments and empty
+ * lines which are printed as they are. */
+struct Block {
+  static const size_t NONE = (size_t) -1;
+
+  vector< pair<size_t,string> > lines;
+  vector<Float> data;
+  size_t frames, first;  // number of frames, line number of the first
+  string error;
+
+  Block() : frames(0), first(0) {}
+
+  void clear() {
+    lines.clear();
+    data.clear();
+    frames = 0;
+    error.clear();
+  }
+};
+
+/* Replaces the frames of the block with the resampled ones. Comments and
+ * empty lines stay where they were, the output frames are put where they
+ * were completed. At the end of the input, the outputs that are left are
+ * put after the last frame. */
+static void resample_block(Resampler &r, Block &block, size_t width, bool last) {
+  vector< pair<size_t,string> > lines;
+  vector<Float> data;
+  size_t after = 0;
+
+  auto out = [&](const Float *y, const string &label) {
+    lines.insert(lines.begin() + after, make_pair(data.size() / width, label));
+    data.insert(data.end(), y, y + width);
+    after++;
+  };
+
+  for (auto &line : block.lines) {
+    if (line.first == Block::NONE) {
+      lines.push_back(line);
+      continue;
+    }
+    after = lines.size();
+    r.push(&block.data[line.first * width], line.second, out);
+  }
+
+  if (last) {
+    if (block.frames == 0)
+      after = 0;
+    r.flush(out);
+  }
+
+  block.lines.swap(lines);
+  block.data.swap(data);
+  block.frames = block.data.size() / std::max(width, (size_t) 1);
+}
+
+/* Passes the frames of the block through the chain, each stage its output on
+ * as it is, without printing it. last is set for the end of the input or
+ * of a segment. Sets the error if a stage failed. */
+static bool filter_block(vector<Stage> &chain, Block &block, vector<Float> &next, bool last) {
+  for (auto &stage : chain) {
+    if (stage.resample) {
+      resample_block(*stage.resample, block, stage.in, last);
+      continue;
+    }
+    if (block.frames == 0)
+      continue;
+    size_t done = run_stage(stage, block.data, next, block.frames);
+    if (done < block.frames) {
+      block.error = "unable to process line " + to_string(block.first + done) + (chain.size() > 1 ? " in " + stage.name : "");
+      return false;
+    }
+  }
+  return true;
+}
+
+static void print_block(const Block &block, size_t width) {
+  for (auto &line : block.lines) {
+    if (line.first == Block::NONE) {
+      cout << line.second << endl;
+      continue;
+    }
+
+    cout << line.second << "\t";
+    for (size_t i=0; i<width; i++)
+      cout << shortest(block.data[line.first*width + i]) << "\t";
+    cout << endl;
+  }
+}
 
 int main(int argc, const char *argv[]) {
   static bool is_running = true;
@@ -28,24 +294,43 @@ int main(int argc, const char *argv[]) {
   c.add<int>   ("verbose",    'v', "verbosity level: 0-4", false, 0);
   c.add        ("help",       'h', "print this message");
   c.add<string>("type",       't', "force classification, regression or timeseries input", false, "", cmdline::oneof<string>("classification", "regression", "timeseries", "auto"));
-  c.footer     ("<pre-processor> [<filename>] ");
+  c.add<string>("chain",      'f', "read the pre-processors from this file, one per line", false, "");
+  c.add<int>   ("block",      'b', "number of frames filtered at once, 0 for 256 from files and 1 otherwise", false, 0);
+  c.add        ("per-segment",'p', "reset the pre-processors for each segment of a timeseries file, i.e. after each empty line");
+  c.add<int>   ("threads",    'j', "number of threads filtering segments with --per-segment, 0 uses all cores", false, 1);
+  c.footer     ("<pre-processor> [options] [+ <pre-processor> [options]]... [<filename>] ");
 
   /* parse common options */
   bool parse_ok = c.parse(argc,argv,false) && !c.exist("help");
   set_verbosity(c.get<int>("verbose"));
+  buffer_stdout();
+
+  /* the stages are either given on the command line or in a file, which
+   * leaves only the input file on the command line */
+  vector< vector<string> > stages;
+  if (c.get<string>("chain") != "") {
+    if (!read_stages(c.get<string>("chain"), stages) || stages.empty()) {
+      cerr << "unable to read pre-processors from " << c.get<string>("chain") << endl;
+      exit(-1);
+    }
+    if (c.rest().size() > 1) {
+      cerr << c.usage() << endl << "only an input file may follow a chain file" << endl;
+      exit(-1);
+    }
+    if (c.rest().size() > 0)
+      input_file = c.rest()[0];
+  } else
+    stages = split_stages(c.rest());
 
   /* do we have a predictor? */
-  string preproc_name = c.rest().size() > 0 ? c.rest()[0] : "list";
+  string preproc_name = stages[0].size() > 0 ? stages[0][0] : "list";
   if (preproc_name == "list") {
     cout << c.usage() << endl;
     cout << list_preprocessors();
     exit(0);
   }
 
-  PreProcessing *pp = apply_cmdline_args(preproc_name,c,1,input_file);
-
-  if (pp==NULL)
-    exit(-1);
+  vector< vector<Stage> > chains(1, build_chain(stages, c, input_file));
 
   if (!parse_ok) {
     cerr << c.usage() << endl << c.error() << endl;
@@ -53,55 +338,120 @@ int main(int argc, const char *argv[]) {
   }
 
   /* do we read from a file or from stdin-? */
-  ifstream fin; fin.open(input_file);
-  istream &in = input_file=="-" ? cin : fin;
+  LineReader in;
+  if (!in.open(input_file)) {
+    cerr << "unable to open " << input_file << endl;
+    exit(-1);
+  }
 
-  string line; int linenum=0;
-  while(getline(in,line)) {
-    stringstream ss(line);
+  /* Frames are read in blocks, so the block filters run over many frames
+   * at once. A stream that is read while it is written is filtered frame by
+   * frame, so no input is held back. */
+  size_t block = c.get<int>("block") > 0 ? c.get<int>("block") : in.mapped() ? 256 : 1;
 
-    if (line[0] == '#') {
-      cout << line << endl;
-      continue;
-    }
+  /* Segments are filtered independently, so each thread has a chain of its
+   * own, and the segments of a batch are spread over the threads. */
+  bool segments = c.exist("per-segment");
+  int threads = c.get<int>("threads");
+  if (threads <= 0)
+    threads = thread::hardware_concurrency();
+  if (!segments)
+    threads = 1;
 
-    if (line.size() == 0) {
-      cout << endl;
-      continue;
-    }
+  for (int t=1; t<threads; t++) {
+    string unused;
+    chains.push_back(build_chain(stages, c, unused));
+  }
+
+  /* Without --per-segment a block is filtered once it is full, or right away
+   * if it has no frames. Otherwise whole segments are read until there are
+   * enough frames for all threads. */
+  const size_t BATCH = 1<<16;
+  vector<Block> batch(1);
+  size_t dims = 0, linenum = 0, pending = 0;
+  const char *b, *e, *tok, *tokend;
+
+  for (bool more = true; more; ) {
+    more = in.getline(b,e);
+    Block &current = batch.back();
+    bool blank = more && b == e;
+
+    if (more && (blank || *b == '#'))
+      current.lines.push_back(make_pair(Block::NONE, string(b,e)));
+
+    else if (more) {
+      string label = next_token(b,e,tok,tokend) ? string(tok,tokend) : "";
+      size_t n = 0;
 
-    try { string label; ss >> label; cout << label << "\t"; }
-    catch (exception &e) { /* unlabeled data */ }
+      for (; next_token(b,e,tok,tokend); n++)
+        current.data.push_back(parse_double(tok,tokend));
 
-    VectorFloat vals; double value;
-    while (ss >> value)
-      vals.push_back(value);
+      if (linenum == 0) {
+        dims = n;
+        for (auto &chain : chains)
+          init_chain(chain, dims, block);
+      } else if (n != dims) {
+        cerr << "unable to process line " << linenum << endl;
+        exit(-1);
+      }
 
-    if (linenum == 0) {
-      // weird stuff, pp resets only when initialized, it only initialized once
-      // data has been seen, and only set num outputdimenstion when reset so:
-      pp->setNumInputDimensions(vals.size());
-      pp->process(VectorFloat(vals.size(), 1.));
-      pp->reset();
+      if (current.frames == 0)
+        current.first = linenum;
+      current.lines.push_back(make_pair(current.frames++, label));
+      linenum++;
+      pending++;
     }
 
-    bool ok = pp->process(vals);
-    if (!ok) {
-      cerr << "unable to process line " << linenum << endl;
-      exit(-1);
+    if (!segments) {
+      if (current.frames < block && more && (current.frames > 0 || current.lines.empty()))
+        continue;
+    } else if (more) {
+      if (!blank)
+        continue;
+      if (pending < BATCH) {
+        batch.push_back(Block());
+        continue;
+      }
     }
 
-    for(auto value : pp->getProcessedData())
-      cout << value << "\t";
+    /* each thread takes the next segment until none is left */
+    atomic<size_t> at(0);
+    auto work = [&](size_t t) {
+      vector<Float> next;
+      for (size_t i; (i = at++) < batch.size(); ) {
+        if (segments)
+          reset_chain(chains[t]);
+        if (!filter_block(chains[t], batch[i], next, segments || !more))
+          break;
+      }
+    };
 
-    cout << endl;
-    linenum++;
+    vector<thread> pool;
+    for (size_t t=1; t<chains.size() && t<batch.size(); t++)
+      pool.push_back(thread(work, t));
+    work(0);
+    for (auto &t : pool)
+      t.join();
+
+    size_t width = chains[0].size() > 0 ? chains[0].back().out : dims;
+    for (auto &part : batch) {
+      if (!part.error.empty()) {
+        cerr << part.error << endl;
+        exit(-1);
+      }
+      print_block(part, width);
+    }
+
+    batch.resize(1);
+    batch[0].clear();
+    pending = 0;
   }
 }
 
-PreProcessing *apply_cmdline_args(string type, cmdline::parser &c, int num_dimensions, string &input_file) {
+PreProcessing *apply_cmdline_args(const vector<string> &args, cmdline::parser &c, int num_dimensions, string &input_file) {
   PreProcessing *pp;
   cmdline::parser p;
+  string type = args[0];
 
   if (type == "DeadZone") {
     p.add<double>("lower-limit", 'L', "lower limit for dead-zone", false, -.1);
@@ -114,9 +464,11 @@ PreProcessing *apply_cmdline_args(string type, cmdline::parser &c, int num_dimen
     p.add<int>   ("filter-size", 'F', "size of the filter", false, 5);
   } else if (type == "FIRFilter") {
     p.add<string>("filter-type",  'T', "filter type, one of LPF, HPF, BPF", false, "LPF", cmdline::oneof<string>("LPF","HPF","BPF"));
-    p.add<int>   ("num-taps   ",  'N', "number of filter taps", false, 50);
+    p.add<int>   ("num-taps",     'N', "number of filter taps, long filters are run by FFT", false, 50);
     p.add<double>("sample-duration",  'S', "sample rate of your data", true);
     p.add<double>("cutoff",       'C', "cutoff frequency of the filter", false, 10);
+    p.add<double>("low-cutoff",   'L', "lower cutoff frequency of a band-pass filter", false, 5);
+    p.add<double>("high-cutoff",  'H', "upper cutoff frequency of a band-pass filter", false, 10);
     p.add<double>("gain",         'G', "filter gain", false, 1);
   } else if (type == "HighPassFilter") {
     p.add<double>("factor",        'F', "the smaller this value the more smoothing is done", false, .1);
@@ -142,7 +494,7 @@ PreProcessing *apply_cmdline_args(string type, cmdline::parser &c, int num_dimen
     return NULL;
   }
 
-  if (!p.parse(c.rest()) || c.exist("help")) {
+  if (!p.parse(args) || c.exist("help")) {
     cerr << c.usage() << endl << "pre processing options:" << endl << p.str_options() << endl << p.error() << endl;
     exit(-1);
   }
@@ -165,13 +517,19 @@ PreProcessing *apply_cmdline_args(string type, cmdline::parser &c, int num_dimen
         num_dimensions);
   } else if (type == "FIRFilter") {
     vector<string> list = {"LPF","HPF","BPF"};
-    pp = new FIRFilter(
-        find(list.begin(),list.end(),p.get<string>("func")) - list.begin(),
+    FIRFilter *fir = new FIRFilter(
+        find(list.begin(),list.end(),p.get<string>("filter-type")) - list.begin(),
         p.get<int>("num-taps"),
         p.get<double>("sample-duration"),
         p.get<double>("cutoff"),
         p.get<double>("gain"),
         num_dimensions);
+    if (p.get<string>("filter-type") == "BPF") {
+      fir->setLowCutoffFrequency(p.get<double>("low-cutoff"));
+      fir->setHighCutoffFrequency(p.get<double>("high-cutoff"));
+      fir->buildFilter();
+    }
+    pp = fir;
   } else if (type == "HighPassFilter") {
     pp = new HighPassFilter(
         p.get<double>("factor"),
@@ -212,3 +570,40 @@ PreProcessing *apply_cmdline_args(string type, cmdline::parser &c, int num_dimen
 
   return pp;
 }
+
+/* Resample changes the rate from one integer rate to another, e.g. from
+ * 800 to 50 Hz, which only needs their ratio. */
+Resampler *apply_resample_args(const vector<string> &args, cmdline::parser &c, string &input_file) {
+  cmdline::parser p;
+
+  p.add<int>   ("from",  'F', "sample rate of the input, in Hz", true, 0, cmdline::range(1, 1<<20));
+  p.add<int>   ("to",    'T', "sample rate of the output, in Hz", true, 0, cmdline::range(1, 1<<20));
+  p.add<int>   ("zeros", 'Z', "zero crossings of the anti-aliasing filter on either side", false, 8, cmdline::range(1, 64));
+  p.add<string>("label", 'L', "label of an output frame, majority of the input frames it covers or of the nearest one", false, "majority", cmdline::oneof<string>("majority","nearest"));
+
+  if (!p.parse(args) || c.exist("help")) {
+    cerr << c.usage() << endl << "pre processing options:" << endl << p.str_options() << endl << p.error() << endl;
+    exit(-1);
+  }
+
+  /* the filter has a phase per step of the reduced ratio */
+  int from = p.get<int>("from"), to = p.get<int>("to"), g = from, r = to;
+  while (r != 0) {
+    int t = g % r;
+    g = r;
+    r = t;
+  }
+  if (std::max(from, to) / g > 4096) {
+    cerr << "Resample: ratio " << to/g << "/" << from/g << " is too fine, at most 4096 steps are supported" << endl;
+    exit(-1);
+  }
+
+  if (p.rest().size() > 0)
+    input_file = p.rest()[0];
+
+  return new Resampler(
+      p.get<int>("to"),
+      p.get<int>("from"),
+      p.get<int>("zeros"),
+      p.get<string>("label") == "majority");
+}
@@ -0,0 +1,351 @@
+#ifndef _QUANTIZED_H_
+#define _QUANTIZED_H_
+
+#include "compiled.h"
+#include <cstdint>
+#include <cmath>
+#include <limits>
+
+/* Softmax, linear SVM and MinDist models with float32 or int8 weights, for
+ * predictions that need not be exactly those of GRT. All three compare a
+ * sample with a set of rows: Softmax has a weight vector per class, a
+ * linear SVM one per pair of classes (the support vectors summed up with
+ * their coefficients), and MinDist a row per cluster. The rows are laid
+ * out in blocks of LANES rows, dimension by dimension, so a sample is
+ * compared with a block with vector instructions.
+ *
+ * int8 weights are scaled per row, i.e. per class or pair, to the range of
+ * the row. The sample is scaled to its own range, so a dot product sums up
+ * int8 products in int32 and is scaled back once. MinDist compares
+ * distances, which are quantized with a single scale for the model so that
+ * differences are taken between integers. Predictions are then decided as
+ * GRT does, including MinDist null rejection. For SVM the likelihood is the
+ * share of pairwise votes won, since GRT has none without probability
+ * estimates. Since the result may differ from GRT, these are only used when
+ * asked for, see grt predict --quantize. */
+class QuantizedModel : public CompiledModel {
+  public:
+    enum Precision { FLOAT32, INT8 };
+
+    /* returns NULL if the classifier can not be quantized */
+    static QuantizedModel *compile(Classifier *classifier, Precision precision) {
+      QuantizedModel *q = new QuantizedModel;
+      q->precision = precision;
+      q->dims      = classifier->getNumInputDimensions();
+      q->scaling   = classifier->getScalingEnabled();
+      q->ranges    = classifier->getRanges();
+      q->rejection = classifier->getNullRejectionEnabled();
+      q->low       = 0;
+      q->high      = 1;
+
+      bool ok = classifier->getTrained() && q->dims > 0 &&
+                (!q->scaling || q->ranges.size() == q->dims) &&
+                (q->softmax(dynamic_cast<Softmax*>(classifier)) ||
+                 q->svm(dynamic_cast<SVM*>(classifier)) ||
+                 q->mindist(dynamic_cast<MinDist*>(classifier)));
+
+      if (!ok) {
+        delete q;
+        return NULL;
+      }
+
+      q->quantize();
+      return q;
+    }
+
+    bool exact() const { return false; }
+
+    const char *name() const { return precision == INT8 ? "int8" : "float32"; }
+
+    bool predict(VectorFloat *const *x, size_t n, UINT *predicted, Float *likelihood) const {
+      vector<float> v(dims), scores(blocks * LANES);
+      vector<int8_t> vq(dims);
+
+      for (size_t i=0; i<n; i++)
+        if (x[i]->size() != dims)
+          return false;
+
+      for (size_t i=0; i<n; i++) {
+        for (size_t j=0; j<dims; j++) {
+          Float value = (*x[i])[j];
+          if (scaling)
+            value = ranges[j].minValue == ranges[j].maxValue ? low :
+                    (value - ranges[j].minValue) / (ranges[j].maxValue - ranges[j].minValue) * (high - low) + low;
+          v[j] = value;
+        }
+
+        if (precision == INT8)
+          score_int8(&v[0], &vq[0], &scores[0]);
+        else
+          score_float32(&v[0], &scores[0]);
+
+        Float l = 0;
+        predicted[i] = kind == SOFTMAX ? decide_softmax(&scores[0], l) :
+                       kind == PAIRS   ? decide_pairs(&scores[0], l) :
+                                         decide_mindist(&scores[0], l);
+        if (likelihood)
+          likelihood[i] = l;
+      }
+
+      return true;
+    }
+
+  protected:
+    static const size_t LANES = 8;
+
+    enum Kind { SOFTMAX, PAIRS, MINDIST };
+
+    Kind kind;
+    Precision precision;
+    size_t dims, rows, blocks, classes;
+    bool scaling, rejection;
+    Float low, high;               // range the input is scaled to
+    vector<MinMax> ranges;
+    vector<UINT> labels;           // class label of each class index
+    vector<uint32_t> first, second; // class (pair) of each row
+    vector<Float> bias;            // added to the score of a row
+    vector<Float> thresholds;      // MinDist rejection threshold per class
+    vector<Float> weights;         // rows before quantization
+
+    vector<float> fblocks;         // rows by blocks of LANES, dimension-major
+    vector<int8_t> qblocks;
+    vector<float> scale;           // int8 scale of each row
+    float modelScale;              // int8 scale of MinDist clusters and samples
+
+    bool softmax(Softmax *s) {
+      if (s == NULL)
+        return false;
+
+      kind = SOFTMAX;
+      for (auto &m : s->getModels()) {
+        if (m.w.size() != dims)
+          return false;
+        labels.push_back(m.classLabel);
+        first.push_back(labels.size() - 1);
+        second.push_back(0);
+        bias.push_back(m.w0);
+        weights.insert(weights.end(), m.w.begin(), m.w.end());
+      }
+
+      classes = labels.size();
+      return classes > 0;
+    }
+
+    /* linear C- or nu-SVC without probabilities, whose support vectors are
+     * summed up into one weight vector per pair of classes like libsvm's
+     * svm_predict_values() goes through them */
+    bool svm(SVM *s) {
+      if (s == NULL || rejection)
+        return false;
+
+      const LIBSVM::svm_model *m = s->getLIBSVMModel();
+      if (m == NULL || m->param.kernel_type != LIBSVM::LINEAR || m->param.probability ||
+          (m->param.svm_type != LIBSVM::C_SVC && m->param.svm_type != LIBSVM::NU_SVC) ||
+          m->nr_class < 2)
+        return false;
+
+      kind    = PAIRS;
+      classes = m->nr_class;
+      low     = SVM_MIN_SCALE_RANGE;
+      high    = SVM_MAX_SCALE_RANGE;
+
+      vector<int> start(classes, 0);
+      for (size_t i=1; i<classes; i++)
+        start[i] = start[i-1] + m->nSV[i-1];
+      for (size_t i=0; i<classes; i++)
+        labels.push_back(m->label[i]);
+
+      for (size_t i=0, p=0; i<classes; i++)
+        for (size_t j=i+1; j<classes; j++, p++) {
+          vector<Float> w(dims, 0);
+          auto add = [&](const double *coef, int from, int count) {
+            for (int k=from; k<from+count; k++)
+              for (const LIBSVM::svm_node *node = m->SV[k]; node->index != -1; node++)
+                if (node->index >= 1 && (size_t) node->index <= dims)
+                  w[node->index - 1] += coef[k] * node->value;
+          };
+          add(m->sv_coef[j-1], start[i], m->nSV[i]);
+          add(m->sv_coef[i],   start[j], m->nSV[j]);
+
+          first.push_back(i);
+          second.push_back(j);
+          bias.push_back(-m->rho[p]);
+          weights.insert(weights.end(), w.begin(), w.end());
+        }
+
+      return true;
+    }
+
+    bool mindist(MinDist *d) {
+      if (d == NULL)
+        return false;
+
+      kind = MINDIST;
+      for (auto &m : d->getModels()) {
+        MatrixFloat clusters = m.getClusters();
+        if (clusters.getNumCols() != dims || clusters.getNumRows() == 0)
+          return false;
+
+        labels.push_back(m.getClassLabel());
+        thresholds.push_back(m.getRejectionThreshold());
+        for (UINT r=0; r<clusters.getNumRows(); r++) {
+          first.push_back(labels.size() - 1);
+          second.push_back(0);
+          bias.push_back(0);
+          weights.insert(weights.end(), clusters[r], clusters[r] + dims);
+        }
+      }
+
+      classes = labels.size();
+      return classes > 0;
+    }
+
+    void quantize() {
+      rows   = first.size();
+      blocks = (rows + LANES - 1) / LANES;
+      fblocks.assign(blocks * LANES * dims, 0);
+      qblocks.assign(blocks * LANES * dims, 0);
+      scale.assign(blocks * LANES, 0);
+      modelScale = 0;
+
+      for (Float w : weights)
+        modelScale = std::max(modelScale, (float) fabs(w) / 127);
+
+      for (size_t r=0; r<rows; r++) {
+        const Float *w = &weights[r * dims];
+        float range = 0;
+        for (size_t j=0; j<dims; j++)
+          range = std::max(range, (float) fabs(w[j]));
+
+        scale[r] = kind == MINDIST ? modelScale : range / 127;
+        for (size_t j=0; j<dims; j++) {
+          size_t at = (r/LANES)*LANES*dims + j*LANES + r%LANES;
+          fblocks[at] = w[j];
+          qblocks[at] = scale[r] == 0 ? 0 : quantize(w[j] / scale[r]);
+        }
+      }
+
+      weights.clear();
+    }
+
+    static int8_t quantize(Float v) {
+      return (int8_t) std::max(-127., std::min(127., round(v)));
+    }
+
+    /* dot products with the rows, or squared distances to them */
+    void score_float32(const float *x, float *scores) const {
+      for (size_t b=0; b<blocks; b++) {
+        const float *block = &fblocks[b*LANES*dims];
+        float d[LANES] = { 0 };
+
+        if (kind == MINDIST)
+          for (size_t j=0; j<dims; j++)
+            for (size_t l=0; l<LANES; l++)
+              d[l] += (x[j] - block[j*LANES + l]) * (x[j] - block[j*LANES + l]);
+        else
+          for (size_t j=0; j<dims; j++)
+            for (size_t l=0; l<LANES; l++)
+              d[l] += x[j] * block[j*LANES + l];
+
+        for (size_t l=0; l<LANES; l++)
+          scores[b*LANES + l] = d[l];
+      }
+    }
+
+    void score_int8(const float *x, int8_t *xq, float *scores) const {
+      float sx = modelScale;
+
+      if (kind != MINDIST) {
+        float range = 0;
+        for (size_t j=0; j<dims; j++)
+          range = std::max(range, fabsf(x[j]));
+        sx = range / 127;
+      }
+
+      for (size_t j=0; j<dims; j++)
+        xq[j] = sx == 0 ? 0 : quantize(x[j] / sx);
+
+      for (size_t b=0; b<blocks; b++) {
+        const int8_t *block = &qblocks[b*LANES*dims];
+        int32_t d[LANES] = { 0 };
+
+        if (kind == MINDIST)
+          for (size_t j=0; j<dims; j++)
+            for (size_t l=0; l<LANES; l++) {
+              int32_t diff = (int32_t) xq[j] - block[j*LANES + l];
+              d[l] += diff * diff;
+            }
+        else
+          for (size_t j=0; j<dims; j++)
+            for (size_t l=0; l<LANES; l++)
+              d[l] += (int32_t) xq[j] * block[j*LANES + l];
+
+        for (size_t l=0; l<LANES; l++)
+          scores[b*LANES + l] = kind == MINDIST ? d[l] * sx * sx : d[l] * sx * scale[b*LANES + l];
+      }
+    }
+
+    /* the class with the largest logistic output, NULL if all are near 0 */
+    UINT decide_softmax(const float *scores, Float &likelihood) const {
+      Float sum = 0, best = -numeric_limits<Float>::max();
+      size_t bestIndex = 0;
+
+      for (size_t k=0; k<classes; k++) {
+        Float estimate = 1. / (1. + exp(-(scores[k] + bias[k])));
+        if (estimate > best) {
+          best = estimate;
+          bestIndex = k;
+        }
+        sum += estimate;
+      }
+
+      if (sum <= 1e-5) {
+        likelihood = best;
+        return 0;
+      }
+
+      likelihood = best / sum;
+      return labels[bestIndex];
+    }
+
+    /* one vote per pair of classes, the first class with most votes wins */
+    UINT decide_pairs(const float *scores, Float &likelihood) const {
+      vector<uint32_t> votes(classes, 0);
+      size_t best = 0;
+
+      for (size_t r=0; r<rows; r++)
+        votes[scores[r] + bias[r] > 0 ? first[r] : second[r]]++;
+
+      for (size_t k=1; k<classes; k++)
+        if (votes[k] > votes[best])
+          best = k;
+
+      likelihood = Float(votes[best]) / (classes - 1);
+      return labels[best];
+    }
+
+    /* the class of the nearest cluster, likelihoods by inverse distance */
+    UINT decide_mindist(const float *scores, Float &likelihood) const {
+      vector<Float> dist(classes, numeric_limits<Float>::max());
+      Float sum = 0, minDist = numeric_limits<Float>::max();
+      size_t best = 0;
+
+      for (size_t r=0; r<rows; r++)
+        dist[first[r]] = std::min(dist[first[r]], (Float) scores[r]);
+
+      for (size_t k=0; k<classes; k++) {
+        if (dist[k] < minDist) {
+          minDist = dist[k];
+          best = k;
+        }
+        sum += 1. / (dist[k] + 0.0001);
+      }
+
+      likelihood = sum != 0 ? 1. / (dist[best] + 0.0001) / sum : 1. / (dist[best] + 0.0001);
+      if (rejection && minDist > thresholds[best])
+        return 0;
+      return labels[best];
+    }
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "libgrt_util.h"
+#include "labelset.h"
 #include "cmdline.h"
 #include <stdint.h>
 #include <math.h>
@@ -9,13 +10,18 @@
 #include <cctype>
 #include <locale>
 
+/* all label strings are interned once, groups only deal with the ids */
+LabelSet labels;
+
 class Group {
   public:
   Matrix<uint64_t> *confusion = NULL;
-  vector<string> labelset;
+  vector<string> labelset; // in order of appearance, i.e. confusion rows
+  vector<int> rows;        // label id to confusion row, -1 if not seen yet
   vector<string> lines;
 
-  void add_prediction(string, string);
+  void add_prediction(uint32_t, uint32_t);
+  int  row(uint32_t label);
   void calculate_score(double beta);
   void calculate_ead();
   double get_meanscore(string, double);
@@ -26,7 +32,7 @@ class Group {
   string to_string(cmdline::parser&, string tag);
   string to_flat_string(cmdline::parser&, string tag, bool first);
 
-  string last_label = "NULL", last_prediction = "NULL";
+  uint32_t last_label = 0, last_prediction = 0; // NULL
 
   struct { // EAD errors according to Ward et.al. 2011
     uint64_t deletions = 0,
@@ -47,7 +53,6 @@ class Group {
 
 /* some helper functions */
 bool   value_differs(map<double,string>&, map<double,string>&);
-int    push_back_if_not_there(string &label, vector<string> &labelset);
 string centered(int, string, int DEFAULT=5);
 string centered(int, double, int DEFAULT=5);
 string centered(int, uint64_t, int DEFAULT=5);
@@ -103,13 +108,16 @@ int main(int argc, char *argv[])
   if (c.exist("flat"))
     c.set_option("no-confusion");
 
+  buffer_stdout();
+
   if (c.exist("no-score") && c.exist("no-confusion") && c.exist("no-ead")) {
     cerr << c.usage() << endl << "error: --no-confusion, --no-score and --no-ead can not be given at the same time" << endl;
     return -1;
   }
 
   /* open standard input or file argument */
-  istream &in = grt_fileinput(c);
+  LineReader &in = grt_lineinput(c);
+  bool from_stdin = c.rest().size()==0 || c.rest()[0]=="-";
   if (!in) return -1;
 
   /* read multiple groups divided by tagged lines, if advised to do so.
@@ -123,67 +131,100 @@ int main(int argc, char *argv[])
    *  (tag) label prediction
    * and untagged ones:
    *  label prediction
+   *
+   * Following a comment line "# label name..." with several names, e.g. as
+   * printed by grt predict with several models, each line holds one
+   * prediction per name, which are scored as one group per name. Columns
+   * named likelihood are skipped.
    */
   string top_score_type = c.get<string>("sort"), top_tag = "";
   double top_score = .0, beta = c.get<double>("F-score");
   unordered_map<string,Group> groups;
            map<double,string> scores;
-  string line, tag="None", prediction, label;
+  string tag="None";
+  vector<string> columns;
+  vector<uint32_t> predictions;
+  const char *line, *end, *pos, *lb, *le, *pb, *pe;
+
+  while (in.getline(line,end)) {
+    for (pos=line; pos<end && lr_isspace(*pos); pos++)
+      ;
+    while (end>pos && lr_isspace(end[-1]))
+      end--;
+
+    if (end-pos > 7 && strncmp(pos, "# label", 7) == 0 && lr_isspace(pos[7])) {
+      columns.clear();
+      for (pos += 7; next_token(pos,end,pb,pe); )
+        columns.push_back(string(pb,pe));
+      continue;
+    }
 
-  while (getline(in,line)) {
-    line = trim(line);
-    if (line=="" || line[0]=='#')
+    if (pos==end || *pos=='#')
       continue;
 
     if (c.exist("group")) {
-      size_t idx = line.find_first_of(')',0);
-      if (idx == string::npos) {
-        cerr << "untagged line, ignored:" << line << endl;
+      const char *idx = (const char*) memchr(pos, ')', end-pos);
+      if (idx == NULL) {
+        cerr << "untagged line, ignored:" << string(pos,end) << endl;
         continue;
       }
 
-      tag = line.substr(1,idx-1);
-      line = line.substr(idx+1,string::npos);
+      tag.assign(pos+1, idx-pos-1);
+      pos = idx+1;
     }
 
-    istringstream iss(trim(line));
-    vector<string> fields{istream_iterator<string>{iss},
-                          istream_iterator<string>{}};
-    if (fields.size() < 2) {
+    const char *fields = pos;
+    if (!next_token(pos,end,lb,le) || !next_token(pos,end,pb,pe)) {
       if (!c.exist("quiet"))
-        cerr << line << " ignored" << endl;
+        cerr << string(fields,end) << " ignored" << endl;
 
       continue;
     }
 
-    label = fields[0];
-    prediction = fields[1];
+    uint32_t label = labels.intern(lb,le);
 
-    /* intermediate top-score reports */
-    if (top_score_type != "disabled" && &in==&cin && c.exist("intermediate")) {
-      double score;
+    predictions.assign(1, labels.intern(pb,pe));
+    while (columns.size() > 1 && predictions.size() < columns.size() && next_token(pos,end,pb,pe))
+      predictions.push_back(labels.intern(pb,pe));
 
-      Group &g = groups[tag];
-      score = g.get_meanscore(top_score_type,beta);
+    for (size_t k=0; k<predictions.size(); k++) {
+      string group = tag;
+      uint32_t prediction = predictions[k];
 
-      if(scores.count(score) && scores[score] == tag)
-        scores.erase(score);
-
-      g.add_prediction(label, prediction);
-      score = g.get_meanscore(top_score_type,beta);
-      scores[score] = tag;
-
-      if (!c.exist("flat"))
-        for(auto &x : scores)
-          cout << groups[x.second].to_string(c,x.second) << endl;
-      else {
-        // TODO
-        // for(auto &x : scores)
-        //   cout << groups[x.second].to_string(c,x.second);
-        // cout << endl;
+      if (columns.size() > 1) {
+        if (columns[k] == "likelihood")
+          continue;
+        group = columns[k];
+        if (c.exist("group"))
+          group = tag + " " + group;
       }
-    } else
-      groups[tag].add_prediction(label, prediction);
+
+      /* intermediate top-score reports */
+      if (top_score_type != "disabled" && from_stdin && c.exist("intermediate")) {
+        double score;
+
+        Group &g = groups[group];
+        score = g.get_meanscore(top_score_type,beta);
+
+        if(scores.count(score) && scores[score] == group)
+          scores.erase(score);
+
+        g.add_prediction(label, prediction);
+        score = g.get_meanscore(top_score_type,beta);
+        scores[score] = group;
+
+        if (!c.exist("flat"))
+          for(auto &x : scores)
+            cout << groups[x.second].to_string(c,x.second) << endl;
+        else {
+          // TODO
+          // for(auto &x : scores)
+          //   cout << groups[x.second].to_string(c,x.second);
+          // cout << endl;
+        }
+      } else
+        groups[group].add_prediction(label, prediction);
+    }
   }
 
   if (top_score_type != "disabled" && groups.size() > 0) {
@@ -210,15 +251,28 @@ int main(int argc, char *argv[])
   return 0;
 }
 
-void Group::add_prediction(string label, string prediction)
+int Group::row(uint32_t label)
+{
+  if (label >= rows.size())
+    rows.resize(label+1, -1);
+
+  if (rows[label] == -1) {
+    rows[label] = labelset.size();
+    labelset.push_back(labels[label]);
+  }
+
+  return rows[label];
+}
+
+void Group::add_prediction(uint32_t label, uint32_t prediction)
 {
   /* first we calculate your every-day confusion matrix, which
    * is later used to calculate TP,TN,FN,FP scores and their stats */
   if (confusion == NULL)
     confusion = new Matrix<uint64_t>();
 
-  int64_t idxA = push_back_if_not_there(prediction, labelset),
-          idxB = push_back_if_not_there(label,      labelset);
+  int64_t idxA = row(prediction),
+          idxB = row(label);
 
   if (confusion->getNumRows() != labelset.size())
     confusion = resize_matrix(confusion, labelset.size());
@@ -228,10 +282,10 @@ void Group::add_prediction(string label, string prediction)
   /* events are hit when both labels are NULL, with one exception handled
    * when a double-NULL was encountered */
   if ( (last_label!=label && last_prediction!=prediction) ||
-       (label=="NULL" && prediction=="NULL") ) {
+       (label==0 && prediction==0) ) {
     calculate_ead();
     prediction_changed = groundtruth_changed = 0;
-    last_prediction = last_label = "NULL";
+    last_prediction = last_label = 0;
   }
 
   /* and then we also calculate the more in-depth analysis of Ward et.al.
@@ -668,14 +722,6 @@ vector<T>  pow(vector<T> m, double pow) {
   return result;
 }
 
-int push_back_if_not_there(string &label, vector<string> &labelset)
-{
- if( std::find(labelset.begin(), labelset.end(), label) == labelset.end() )
-  labelset.push_back(label);
-
- return std::find(labelset.begin(), labelset.end(), label) - labelset.begin();
-}
-
 template< class T>
 std::vector<T> operator-(const std::vector<T> &a, const std::vector<T> &b)
 {
@@ -0,0 +1,317 @@
+#ifndef _SEARCH_H_
+#define _SEARCH_H_
+
+#include "crossval.h"
+#include <poll.h>
+#include <time.h>
+#include <sys/wait.h>
+
+/* One dimension of a parameter search, given as either a list of values
+ * (name=a,b,c) or a numeric range (name=lo:hi or name=lo:hi:steps). */
+struct SearchParam {
+  string name;
+  vector<string> values;
+  double lo, hi;
+  int steps;
+  bool range, integral;
+};
+
+/* outcome of a single parameter combination */
+struct SearchTrial {
+  enum { PENDING, DONE, FAILED, TIMEOUT };
+
+  vector<string> args;   // --name=value for each searched parameter
+  int status;
+  double accuracy, f1, seconds;
+
+  SearchTrial() : status(PENDING), accuracy(0), f1(0), seconds(0) {}
+};
+
+static bool is_integer(const string &s) {
+  char *end;
+  strtol(s.c_str(), &end, 10);
+  return s.size() && *end == 0;
+}
+
+static string format_param(double v, bool integral) {
+  char buf[32];
+  if (integral) snprintf(buf, sizeof(buf), "%ld", lround(v));
+  else          snprintf(buf, sizeof(buf), "%g", v);
+  return buf;
+}
+
+/* parses parameters separated by whitespace or semicolons */
+static bool parse_search_spec(const string &spec, vector<SearchParam> &params, string &error)
+{
+  string s = spec;
+  replace(s.begin(), s.end(), ';', ' ');
+  istringstream in(s);
+  string tok;
+
+  while (in >> tok) {
+    SearchParam p;
+    size_t eq = tok.find('=');
+
+    if (eq == string::npos || eq == 0 || eq+1 == tok.size()) {
+      error = "expected name=values in search specification, got: " + tok;
+      return false;
+    }
+
+    p.name = tok.substr(0, eq);
+    while (p.name.compare(0, 1, "-") == 0) p.name.erase(0, 1);
+    string values = tok.substr(eq+1);
+
+    p.range = values.find(':') != string::npos;
+    p.steps = 0;
+
+    if (p.range) {
+      vector<string> parts;
+      istringstream r(values);
+      for (string part; getline(r, part, ':'); ) parts.push_back(part);
+
+      char *e1, *e2;
+      if (parts.size() < 2 || parts.size() > 3 ||
+          (p.lo = strtod(parts[0].c_str(), &e1), *e1) ||
+          (p.hi = strtod(parts[1].c_str(), &e2), *e2) || p.lo > p.hi ||
+          (parts.size() == 3 && (p.steps = atoi(parts[2].c_str())) < 1)) {
+        error = "invalid range for " + p.name + ", expected lo:hi or lo:hi:steps";
+        return false;
+      }
+
+      p.integral = is_integer(parts[0]) && is_integer(parts[1]);
+    } else {
+      istringstream r(values);
+      for (string v; getline(r, v, ','); )
+        if (v.size()) p.values.push_back(v);
+    }
+
+    params.push_back(p);
+  }
+
+  if (params.empty()) {
+    error = "empty search specification";
+    return false;
+  }
+
+  return true;
+}
+
+/* Expands the parameters into trials, all combinations if ntrials is zero
+ * and ntrials random draws otherwise, taken from the generator that splits
+ * the folds. For a grid, ranges are split into the given number of steps,
+ * integral ranges without steps into every value. */
+static bool search_trials(const vector<SearchParam> &params, int ntrials,
+                          vector<SearchTrial> &trials, string &error)
+{
+  if (ntrials > 0) {
+    for (int t=0; t<ntrials; t++) {
+      SearchTrial trial;
+      for (auto &p : params) {
+        string v;
+        if (!p.range)
+          v = p.values[uniform_int_distribution<size_t>(0, p.values.size()-1)(split_random())];
+        else if (p.integral)
+          v = format_param(uniform_int_distribution<long>(lround(p.lo), lround(p.hi))(split_random()), true);
+        else
+          v = format_param(uniform_real_distribution<double>(p.lo, p.hi)(split_random()), false);
+        trial.args.push_back("--" + p.name + "=" + v);
+      }
+      trials.push_back(trial);
+    }
+    return true;
+  }
+
+  vector< vector<string> > grid;
+  for (auto &p : params) {
+    vector<string> values = p.values;
+
+    if (p.range && p.steps > 0)
+      for (int i=0; i<p.steps; i++)
+        values.push_back(format_param(p.steps == 1 ? p.lo :
+          p.lo + i * (p.hi - p.lo) / (p.steps - 1), p.integral));
+    else if (p.range && p.integral)
+      for (long v=lround(p.lo); v<=lround(p.hi); v++)
+        values.push_back(format_param(v, true));
+    else if (p.range) {
+      error = "the range of " + p.name + " needs a number of steps (lo:hi:steps) for a grid search";
+      return false;
+    }
+
+    grid.push_back(values);
+  }
+
+  vector<size_t> index(params.size(), 0);
+  for (;;) {
+    SearchTrial trial;
+    for (size_t i=0; i<params.size(); i++)
+      trial.args.push_back("--" + params[i].name + "=" + grid[i][index[i]]);
+    trials.push_back(trial);
+
+    size_t i = 0;
+    while (i < index.size() && ++index[i] == grid[i].size())
+      index[i++] = 0;
+    if (i == index.size())
+      break;
+  }
+
+  return true;
+}
+
+static double monotonic_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Runs every trial as a cross-validation of its candidate classifier. Each
+ * trial is a forked process that shares the dataset copy-on-write with this
+ * one, up to threads of them run at the same time (0 for all cores). A trial
+ * still running after budget seconds (if not zero) is killed. The folds are
+ * split once, so all trials are compared on the same folds. */
+template<class Data>
+bool run_search(vector<Classifier*> &candidates, vector<SearchTrial> &trials, Data &data,
+                UINT k, UINT nlabels, int threads, double budget)
+{
+  struct result { double accuracy, f1; };
+  struct running { size_t trial; pid_t pid; int fd; double start; };
+
+  if (threads <= 0)
+    threads = thread::hardware_concurrency();
+  threads = std::max(threads, 1);
+
+  vector<Indices> split = kfold_split(data, k);
+  if (split.empty())
+    return false;
+
+  cout.flush(); cerr.flush(); fflush(NULL);
+
+  vector<running> active;
+  size_t next = 0;
+
+  while (next < trials.size() || active.size() > 0) {
+    while ((int) active.size() < threads && next < trials.size()) {
+      int fds[2];
+      if (pipe(fds) != 0)
+        return false;
+
+      pid_t pid = fork();
+      if (pid < 0)
+        return false;
+
+      if (pid == 0) {
+        vector<Confusion> folds;
+        Confusion all(nlabels, vector<uint64_t>(nlabels, 0));
+        result r;
+        uint64_t n;
+
+        /* _exit() does not flush, what has been written to cout is kept */
+        close(fds[0]);
+        bool ok = cross_validate(candidates[next], data, split, nlabels, 1, folds);
+        cout.flush(); cerr.flush(); fflush(NULL);
+        if (!ok)
+          _exit(1);
+
+        for (auto &f : folds)
+          for (UINT i=0; i<nlabels; i++)
+            for (UINT j=0; j<nlabels; j++)
+              all[i][j] += f[i][j];
+
+        confusion_scores(all, n, r.accuracy, r.f1);
+        _exit(write(fds[1], &r, sizeof(r)) == sizeof(r) ? 0 : 1);
+      }
+
+      close(fds[1]);
+      running t = { next++, pid, fds[0], monotonic_seconds() };
+      active.push_back(t);
+    }
+
+    /* wait for a trial to finish or for the next deadline */
+    vector<struct pollfd> polls;
+    double now = monotonic_seconds(), wait = -1;
+
+    for (auto &t : active) {
+      struct pollfd p = { t.fd, POLLIN, 0 };
+      polls.push_back(p);
+      double left = std::max(t.start + budget - now, 0.);
+      if (budget > 0)
+        wait = wait < 0 ? left : std::min(wait, left);
+    }
+
+    poll(&polls[0], polls.size(), wait < 0 ? -1 : (int) ceil(wait * 1000));
+    now = monotonic_seconds();
+
+    for (size_t i=active.size(); i-- > 0; ) {
+      running &t = active[i];
+      SearchTrial &trial = trials[t.trial];
+
+      if (polls[i].revents == 0 && !(budget > 0 && now - t.start >= budget))
+        continue;
+
+      if (polls[i].revents != 0) {
+        result r;
+        int status;
+        bool ok = read(t.fd, &r, sizeof(r)) == sizeof(r);
+
+        waitpid(t.pid, &status, 0);
+        ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        trial.status   = ok ? SearchTrial::DONE : SearchTrial::FAILED;
+        trial.accuracy = ok ? r.accuracy : 0;
+        trial.f1       = ok ? r.f1 : 0;
+      } else {
+        kill(t.pid, SIGKILL);
+        waitpid(t.pid, NULL, 0);
+        trial.status = SearchTrial::TIMEOUT;
+      }
+
+      trial.seconds = now - t.start;
+      close(t.fd);
+      active.erase(active.begin() + i);
+    }
+  }
+
+  return true;
+}
+
+/* Prints all trials ranked by their F1 score, failed trials last. Returns
+ * the index of the best trial, or -1 if none succeeded. */
+static int print_search(ostream &out, const vector<SearchTrial> &trials)
+{
+  vector<size_t> order(trials.size());
+  for (size_t i=0; i<order.size(); i++) order[i] = i;
+
+  stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    const SearchTrial &x = trials[a], &y = trials[b];
+    if ((x.status == SearchTrial::DONE) != (y.status == SearchTrial::DONE))
+      return x.status == SearchTrial::DONE;
+    if (x.f1 != y.f1) return x.f1 > y.f1;
+    return x.accuracy > y.accuracy;
+  });
+
+  ios::fmtflags flags = out.flags();
+  streamsize precision = out.precision();
+  out << "rank\tF1\taccuracy\tseconds\tparameters" << endl;
+  out << fixed << setprecision(6);
+
+  for (size_t r=0; r<order.size(); r++) {
+    const SearchTrial &t = trials[order[r]];
+
+    if (t.status == SearchTrial::DONE)
+      out << r+1 << "\t" << t.f1 << "\t" << t.accuracy;
+    else
+      out << (t.status == SearchTrial::TIMEOUT ? "timeout" : "failed") << "\t-\t-";
+
+    out << "\t" << setprecision(2) << t.seconds << setprecision(6) << "\t";
+    for (size_t i=0; i<t.args.size(); i++)
+      out << (i ? " " : "") << t.args[i];
+    out << endl;
+  }
+
+  out.flags(flags);
+  out.precision(precision);
+
+  if (order.empty() || trials[order[0]].status != SearchTrial::DONE)
+    return -1;
+  return order[0];
+}
+
+#endif
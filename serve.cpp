@@ -0,0 +1,209 @@
+#include "libgrt_util.h"
+#include "cmdline.h"
+#include "predict.h"
+#include "socket.h"
+#include "modelwatch.h"
+#include <deque>
+
+/* a model loaded once, with a copy of the classifier for each worker. It
+ * is reloaded whenever its file is rewritten. */
+struct ServedModel {
+  string name;
+  ReloadingModel *model;
+};
+
+static string basename_of(const string &path) {
+  size_t slash = path.rfind('/');
+  return slash == string::npos ? path : path.substr(slash+1);
+}
+
+static ServedModel* find_model(vector<ServedModel> &models, const string &name) {
+  if (name == "-")
+    return &models[0];
+  for (auto &m : models)
+    if (m.name == name)
+      return &m;
+  for (auto &m : models)
+    if (basename_of(m.name) == basename_of(name))
+      return &m;
+  return NULL;
+}
+
+/* answers a single request, see socket.h for the protocol */
+static void serve_client(int fd, vector<ServedModel> &models, int worker)
+{
+  string request, command, name, flag, error;
+  PredictOptions opt = { 1, false, false, 0, 1, false };
+  ServedModel *model = NULL;
+
+  FdBuffer buf(fd);
+  ostream out(&buf);
+
+  if (read_line(fd, request)) {
+    istringstream ss(request);
+    ss >> command >> name;
+    while (ss >> flag) {
+      if (flag == "likelihood") opt.likelihood = true;
+      else if (flag == "null")  opt.null = true;
+      else command.clear();
+    }
+  }
+
+  if (command != "predict" || name.empty()) {
+    out << "error invalid request: " << request << endl;
+    return;
+  }
+
+  if ((model = find_model(models, name)) == NULL) {
+    out << "error no such model: " << name << endl;
+    return;
+  }
+
+  /* samples are predicted one by one, so that streaming clients get their
+   * answers right away. Parallelism comes from serving many clients. A
+   * reloaded model is used from the next sample on. */
+  shared_ptr<ModelVersion> version = model->model->current();
+  Predictor predictor(vector<Classifier*>(1, version->copies[worker]), version->compiled);
+  predictor.classifiers[0]->reset();
+
+  ModelUpdate update = [&](Predictor &p) {
+    shared_ptr<ModelVersion> latest = model->model->current();
+    if (latest == version)
+      return false;
+    version = latest;
+    p = Predictor(vector<Classifier*>(1, version->copies[worker]), version->compiled);
+    p.classifiers[0]->reset();
+    return true;
+  };
+
+  FILE *f = fdopen(dup(fd), "r");
+  if (f == NULL) {
+    out << "error " << strerror(errno) << endl;
+    return;
+  }
+
+  LineReader in(f);
+  CsvIOSample io(predictor.classifiers[0]->getTimeseriesCompatible() ? "timeseries" : "classification");
+  bool ok = false;
+
+  out << "ok" << endl;
+  try {
+    ok = predict_stream(predictor, in, io, out, opt, error, &is_running, update);
+  } catch (exception &e) {
+    error = e.what();
+  }
+
+  if (ok)
+    out << "end" << endl;
+  else {
+    out << "error " << error << endl;
+    cerr << model->name << ": " << error << endl;
+  }
+
+  in.close();
+  fclose(f);
+}
+
+int main(int argc, const char *argv[])
+{
+  cmdline::parser c;
+
+  c.add<int>   ("verbose", 'v', "verbosity level: 0-4", false, 0);
+  c.add        ("help",    'h', "print this message");
+  c.add<string>("socket",  's', "socket to listen on", false, default_socket());
+  c.add<int>   ("threads", 'j', "number of clients served at the same time, 0 uses all cores", false, 0);
+  c.footer     ("<classifier-model-file>...");
+
+  if (!c.parse(argc,argv,true) || c.exist("help") || c.rest().size() == 0) {
+    cerr << c.usage() << "\n" << c.error() << "\n";
+    return -1;
+  }
+
+  set_verbosity(c.get<int>("verbose"));
+
+  int threads = c.get<int>("threads");
+  if (threads <= 0)
+    threads = thread::hardware_concurrency();
+  threads = std::max(threads, 1);
+
+  /* load every model once and copy it for each worker */
+  vector<ServedModel> models;
+  for (auto &name : c.rest()) {
+    ServedModel m;
+    m.name  = name;
+    m.model = new ReloadingModel(name, threads, c.get<int>("verbose") > 0);
+
+    ModelHeader header;
+    Classifier *classifier = loadClassifierFromFile(name, &header);
+    if (classifier == NULL) {
+      cerr << "unable to load classification model " << name << endl;
+      return -1;
+    }
+
+    if (!m.model->load(classifier, header)) {
+      cerr << "unable to copy the classifier of " << name << endl;
+      return -1;
+    }
+
+    if (!m.model->watch())
+      cerr << "unable to watch " << name << " for changes, it will not be reloaded" << endl;
+
+    models.push_back(m);
+  }
+
+  string path = c.get<string>("socket"), error;
+  int fd = unix_listen(path, error);
+
+  if (fd < 0) {
+    cerr << error << endl;
+    return -1;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  set_running_indicator(&is_running);
+
+  if (c.get<int>("verbose") > 0)
+    cerr << "serving " << models.size() << " model(s) on " << path << endl;
+
+  /* connections are queued for a fixed pool of workers */
+  deque<int> pending;
+  mutex lock;
+  condition_variable ready;
+  vector<thread> pool;
+
+  for (int w=0; w<threads; w++)
+    pool.push_back(thread([&,w]() {
+      for (;;) {
+        unique_lock<mutex> l(lock);
+        ready.wait(l, [&]() { return !pending.empty(); });
+        int client = pending.front();
+        pending.pop_front();
+        l.unlock();
+
+        serve_client(client, models, w);
+        close(client);
+      }
+    }));
+
+  while (is_running) {
+    int client = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+    if (client < 0) {
+      if (errno != EINTR && errno != ECONNABORTED) {
+        cerr << "accept failed: " << strerror(errno) << endl;
+        sleep(1);
+      }
+      continue;
+    }
+
+    lock_guard<mutex> l(lock);
+    pending.push_back(client);
+    ready.notify_one();
+  }
+
+  /* clients being served are cut off. The pool workers may still be
+   * predicting, so exit without running static destructors under them */
+  close(fd);
+  unlink(path.c_str());
+  cout.flush(); cerr.flush();
+  _exit(0);
+}
@@ -0,0 +1,142 @@
+#ifndef _SOCKET_H_
+#define _SOCKET_H_
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <streambuf>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "output.h"
+
+/* Local sockets as used by grt serve and grt predict --connect. A client
+ * connects and sends a single request line
+ *
+ *   predict <model> [likelihood] [null]
+ *
+ * followed by its input as for grt predict, either as text or as a binary
+ * dataset (see grt-convert). The server answers with a line "ok", the lines
+ * grt predict prints for the samples as they are predicted, each of which
+ * has a tab in it, and a last line "end" once all of the input has been
+ * read. If the request or the input can not be predicted, the last line is
+ * "error <message>" instead, which may also be the only one. The model is
+ * either one of the names given to grt serve, its basename or "-" for the
+ * first model. */
+
+/* $GRT_SOCKET if set, otherwise a per-user socket in /tmp */
+static std::string default_socket() {
+  const char *env = getenv("GRT_SOCKET");
+  if (env && *env)
+    return env;
+  return "/tmp/grt-" + std::to_string(getuid()) + ".sock";
+}
+
+static bool unix_address(const std::string &path, struct sockaddr_un &addr) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path))
+    return false;
+  strcpy(addr.sun_path, path.c_str());
+  return true;
+}
+
+/* returns a connected socket or -1 */
+static int unix_connect(const std::string &path) {
+  struct sockaddr_un addr;
+  if (!unix_address(path, addr))
+    return errno = ENAMETOOLONG, -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+
+  if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+    int err = errno;
+    close(fd);
+    return errno = err, -1;
+  }
+
+  return fd;
+}
+
+/* Returns a listening socket or -1. A socket file left behind by a server
+ * that is gone is replaced, one that still accepts connections is not. */
+static int unix_listen(const std::string &path, std::string &error) {
+  struct sockaddr_un addr;
+  if (!unix_address(path, addr))
+    return error = "socket path too long: " + path, -1;
+
+  int fd = unix_connect(path);
+  if (fd >= 0) {
+    close(fd);
+    return error = "another server is listening on " + path, -1;
+  }
+
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(path.c_str());
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0 ||
+      bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    error = "unable to listen on " + path + ": " + strerror(errno);
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/* reads a line of at most max bytes without reading past it */
+static bool read_line(int fd, std::string &line, size_t max = 4096) {
+  char c;
+  line.clear();
+  while (line.size() < max) {
+    ssize_t r = read(fd, &c, 1);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      return false;
+    if (c == '\n')
+      return true;
+    line += c;
+  }
+  return false;
+}
+
+/* an output stream buffer writing to a file descriptor */
+class FdBuffer : public std::streambuf {
+  public:
+    FdBuffer(int fd, size_t size = 1<<16) : fd(fd), buf(size) {
+      setp(&buf[0], &buf[0] + buf.size());
+    }
+    ~FdBuffer() { sync(); }
+
+  protected:
+    int fd;
+    std::vector<char> buf;
+
+    int overflow(int c) {
+      if (sync() != 0)
+        return traits_type::eof();
+      if (c != traits_type::eof()) {
+        *pptr() = c;
+        pbump(1);
+      }
+      return traits_type::not_eof(c);
+    }
+
+    int sync() {
+      size_t n = pptr() - pbase();
+      setp(&buf[0], &buf[0] + buf.size());
+      return write_all(fd, &buf[0], n) ? 0 : -1;
+    }
+};
+
+#endif
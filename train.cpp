@@ -3,11 +3,13 @@
 #include <stdio.h>
 #include "cmdline.h"
 #include "libgrt_util.h"
+#include "search.h"
+#include "modelwatch.h"
 
 using namespace GRT;
 using namespace std;
 
-Classifier *apply_cmdline_args(string,cmdline::parser&,int,string&);
+Classifier *apply_cmdline_args(string,cmdline::parser&,int,string&,const vector<string>& = vector<string>());
 string list_classifiers();
 InfoLog info;
 
@@ -20,12 +22,25 @@ int main(int argc, const char *argv[])
   c.add<int>   ("verbose", 'v', "verbosity level: 0-4", false, 1);
   c.add        ("help",    'h', "print this message");
   c.add<string>("output",  'o', "store trained classifier in file", false);
+  c.add        ("binary",  'b', "store the classifier in the binary model format");
   c.add<string>("trainset",'n', "split the trainig set, either no, random, or k-fold split, defaults to no split.", false, "-1");
+  c.add<int>   ("cv",      'k', "report the scores of a k-fold cross-validation, folds are trained in parallel", false, 0);
+  c.add<int>   ("threads", 'j', "number of threads for parsing the input, training folds and search trials, 0 uses all cores", false, 0);
+  c.add<string>("search",   0,  "search classifier parameters, e.g. \"max-depth=5:20 num-split=50,100\"", false);
+  c.add<int>   ("trials",   0,  "number of random parameter combinations to search, 0 searches the whole grid", false, 0);
+  c.add<double>("budget",   0,  "maximum number of seconds for each search trial, 0 for no limit", false, 0);
+  c.add<int>   ("seed",     0,  "seed for random splits, folds and search trials", false, 0);
   c.footer     ("<classifier> [input-data]...");
 
   /* parse common arguments */
   bool parse_ok = c.parse(argc, argv, false)  && !c.exist("help");
   set_verbosity(c.get<int>("verbose"));
+  seed_split_random(c.get<int>("seed"));
+
+  /* a search forks, which must not happen while the writer thread of the
+   * output buffer may hold its lock, so output is buffered after it */
+  if (!c.exist("search"))
+    buffer_stdout();
 
   /* got a trainable classifier? */
   string str_classifier = c.rest().size() > 0 ? c.rest()[0] : "list";
@@ -48,6 +63,32 @@ int main(int argc, const char *argv[])
     return -1;
   }
 
+  /* one classifier per parameter combination to search */
+  vector<SearchTrial> trials;
+  vector<Classifier*> candidates;
+
+  if (c.exist("search")) {
+    vector<SearchParam> params;
+    string error, ignored;
+
+    if (!parse_search_spec(c.get<string>("search"), params, error) ||
+        !search_trials(params, c.get<int>("trials"), trials, error)) {
+      cerr << error << endl;
+      return -1;
+    }
+
+    for (auto &t : trials) {
+      Classifier *candidate = apply_cmdline_args(str_classifier,c,1,ignored,t.args);
+      if (candidate == NULL) {
+        cerr << "error: unable to create algorithm with parameters";
+        for (auto &a : t.args) cerr << " " << a;
+        cerr << endl;
+        return -1;
+      }
+      candidates.push_back(candidate);
+    }
+  }
+
   /* check if we can open the output file */
   ofstream test(c.get<string>("output"), ios_base::out);
   ostream &output = c.exist("output") ? test : cout;
@@ -58,10 +99,9 @@ int main(int argc, const char *argv[])
   }
 
   /* do we read from a file or stdin? */
-  ifstream fin; fin.open(input_file);
-  istream &in = input_file=="-" ? cin : fin;
+  LineReader in;
 
-  if (!in.good()) {
+  if (!in.open(input_file)) {
     cerr << "unable to open input file " << input_file << endl;
     return -1;
   }
@@ -82,6 +122,12 @@ int main(int argc, const char *argv[])
   // special case for a ratio of 100%
   if (ratio == 1) ratio = -1;
 
+  int cv = c.get<int>("cv");
+  if ((cv != 0 || c.exist("search")) && (cv == 1 || cv < 0 || isfile || ratio > 0)) {
+    cerr << "cross-validation needs at least two folds and can not be combined with -n" << endl;
+    return -1;
+  }
+
   // do some sanity checks on the arguments
   if (!isfile && ratio >= 0) {
     // k-fold specification
@@ -105,87 +151,101 @@ int main(int argc, const char *argv[])
   }
 
   /* per default we read from the main inputstream */
-  ifstream tif; istream &tin = isfile ? tif : in;
+  LineReader tif; LineReader &tin = isfile ? tif : in;
   if (isfile) tif.open(file);
 
   /* now read the input file completely */
-  while ( tin >> io ) {
-    bool ok=false; csvio_dispatch(io, ok=dataset.add, io.labelset);
-
-    if (!ok) {
-      cerr << "error at line " << io.linenum << endl;
-      exit(-1);
-    }
+  if (!dataset.read(tin, io, c.get<int>("threads"))) {
+    cerr << "error at line " << dataset.errline << endl;
+    exit(-1);
   }
 
   /* empty input? */
   if (dataset.size() == 0)
     return 0;
 
-  /* generate training sets if any are required, which is either a timeseries
-   * or classification data */
-  TimeSeriesClassificationData t_test, t_training;
-  ClassificationData           c_test, c_training;
-
-  /* There is a case for polymorphism in GRT here */
-  switch(io.type) {
-  case TIMESERIES:
-    if (isfile || ratio <= 0) // no split or file
-      t_training = dataset.t_data;
-    else if (ratio < 1) {     // random split
-      t_test     = dataset.t_data.partition( ratio*100, true );
-      t_training = dataset.t_data;
-    }
-    else if (ratio >= 1) {    // k-fold
-      if (!dataset.t_data.splitDataIntoKFolds( integral, false, false )) {
-        cerr << "unable to split data" << endl;
-        return -1;
-      }
-      t_test     = dataset.t_data.getTestFoldData( fraction );
-      t_training = dataset.t_data.getTrainingFoldData( fraction );
-    }
-    else {
-      cerr << "unknown train set specification" << endl;
+  /* rank all parameter combinations by cross-validation (three folds if not
+   * given otherwise) and continue training with the best one. The ranking
+   * goes to stdout, unless that is where the model is written to. */
+  if (c.exist("search")) {
+    UINT k = cv > 0 ? cv : 3;
+    bool ok = false;
+
+    if (io.type == TIMESERIES)
+      ok = run_search(candidates, trials, dataset.t_data, k, io.labelset.size(), c.get<int>("threads"), c.get<double>("budget"));
+    else
+      ok = run_search(candidates, trials, dataset.c_data, k, io.labelset.size(), c.get<int>("threads"), c.get<double>("budget"));
+
+    buffer_stdout();
+    int best = ok ? print_search(c.exist("output") ? cout : cerr, trials) : -1;
+    if (best < 0) {
+      cerr << "parameter search failed" << endl;
       return -1;
     }
-    break;
-  case CLASSIFICATION:
-    if (isfile || ratio <= 0) // no split or file
-      c_training = dataset.c_data;
-    else if (ratio < 1)  { // random split
-      c_test     = dataset.c_data.partition( ratio*100, true );
-      c_training = dataset.c_data;
-    }
-    else if (ratio >= 1) { // k-fold
-      if (!dataset.c_data.splitDataIntoKFolds( integral, false, false )) {
-        cerr << "unable to split data" << endl;
-        return -1;
-      }
-      c_test     = dataset.c_data.getTestFoldData( fraction );
-      c_training = dataset.c_data.getTrainingFoldData( fraction );
-    }
-    else {
-      cerr << "unknown train set specification" << endl;
+
+    delete classifier;
+    classifier = candidates[best];
+    for (size_t i=0; i<candidates.size(); i++)
+      if ((int) i != best) delete candidates[i];
+  }
+
+  /* evaluate all folds, the model is only trained and stored on the whole
+   * dataset if an output file has been given */
+  else if (cv > 0) {
+    vector<Confusion> folds;
+    bool ok = false;
+
+    if (io.type == TIMESERIES)
+      ok = cross_validate(classifier, dataset.t_data, cv, io.labelset.size(), c.get<int>("threads"), folds);
+    else
+      ok = cross_validate(classifier, dataset.c_data, cv, io.labelset.size(), c.get<int>("threads"), folds);
+
+    if (!ok) {
+      cerr << "cross-validation failed" << endl;
       return -1;
     }
 
-    break;
-  default:
-    cerr << "io type not implemented" << endl;
-    return -1;
+    print_cross_validation(cout, folds, io.labelset);
+    if (!c.exist("output"))
+      return 0;
+  }
+
+  /* select the samples held out for testing by their index. They are moved
+   * out of the dataset, which is then trained on in place. */
+  vector<TimeSeriesClassificationSample> t_test;
+  vector<ClassificationSample>           c_test;
+  Indices held;
+
+  if (!isfile && ratio > 0 && ratio < 1) // random split
+    held = io.type == TIMESERIES ? random_split(dataset.t_data, ratio)
+                                 : random_split(dataset.c_data, ratio);
+  else if (!isfile && ratio >= 1) {       // k-fold
+    vector<Indices> folds = io.type == TIMESERIES ? kfold_split(dataset.t_data, integral)
+                                                  : kfold_split(dataset.c_data, integral);
+    if (folds.empty()) {
+      cerr << "unable to split data" << endl;
+      return -1;
+    }
+    held = folds[fraction];
   }
 
   info << dataset.getStatsAsString() << endl;
 
-  /* train and save classifier */
+  /* train and save classifier. Training in place lets the classifier scale
+   * the dataset instead of a copy. */
   bool ok = false;
   switch(io.type) {
   case TIMESERIES:
-    ok = classifier->train(t_training);
+    split_off(dataset.t_data, held, t_test);
+    ok = classifier->train_(dataset.t_data);
     break;
   case CLASSIFICATION:
-    ok = classifier->train(c_training);
+    split_off(dataset.c_data, held, c_test);
+    ok = classifier->train_(dataset.c_data);
     break;
+  default:
+    cerr << "io type not implemented" << endl;
+    return -1;
   }
 
   if (!ok) {
@@ -193,12 +253,27 @@ int main(int argc, const char *argv[])
     return -1;
   }
 
+  if (c.get<int>("verbose") >= 2)
+    cerr << "peak memory usage: " << peak_memory_mb() << " MB" << endl;
+
   /* propagate the classlabel names also */
   for (size_t i=!io.has_NULL_label; i<io.labelset.size(); i++) {
     classifier->setClassNameForLabel(i, io.labelset[i]);
   }
 
-  if (!classifier->saveModelToFile(output)){
+  /* binary models also keep the compiled form of the classifier */
+  bool saved = false;
+  if (c.exist("binary")) {
+    BinaryModelWriter model;
+    unique_ptr<CompiledModel> compiled(compileClassifier(classifier));
+    if (compiled) compiled->save(model);
+    saved = saveBinaryModel(output, classifier, io.labelset, model);
+  } else {
+    saveModelHeader(output, classifier, io.labelset);
+    saved = classifier->saveModelToFile(output);
+  }
+
+  if (!saved) {
     cerr << "saving to " << c.get<string>("output") << " failed" << endl;
     return -1;
   }
@@ -212,15 +287,15 @@ int main(int argc, const char *argv[])
   // depending on the mode that has been selected.
   if (isfile) {
     string line;
-    while (getline(in, line))
+    while (in.getline(line))
       cout << line << endl;
   } else if (ratio > 0) { // random split
     bool first = true;
 
     switch(io.type) {
     case TIMESERIES:
-      for (auto sample : t_test.getClassificationData()) {
-        string label = t_test.getClassNameForCorrespondingClassLabel( sample.getClassLabel() );
+      for (auto &sample : t_test) {
+        const string &label = io.labelset[ sample.getClassLabel() ];
         MatrixFloat &matrix = sample.getData();
 
         if (first) first = false;
@@ -229,17 +304,17 @@ int main(int argc, const char *argv[])
         for (int i=0; i<matrix.getNumRows(); i++) {
           cout << label;
           for (int j=0; j<matrix.getNumCols(); j++)
-            cout << " " << matrix[i][j];
+            cout << " " << shortest(matrix[i][j]);
           cout << endl;
         }
       }
       break;
     case CLASSIFICATION:
-      for (auto sample : c_test.getClassificationData()) {
-        string label = c_test.getClassNameForCorrespondingClassLabel( sample.getClassLabel() );
+      for (auto &sample : c_test) {
+        const string &label = io.labelset[ sample.getClassLabel() ];
         cout << label;
         for (auto val : sample.getSample())
-            cout << "\t" << val;
+            cout << "\t" << shortest(val);
         cout << endl;
       }
       break;
@@ -282,7 +357,7 @@ string list_classifiers() {
 
 #define checkedarg(func, type, name) if(!func(p.get<type>(name))) { cerr << "invalid value for" << name << " " << p.get<type>(name) << endl; return NULL; }
 
-Classifier *apply_cmdline_args(string name,cmdline::parser& c,int num_dimensions,string &input_file)
+Classifier *apply_cmdline_args(string name,cmdline::parser& c,int num_dimensions,string &input_file,const vector<string> &overrides)
 {
   cmdline::parser p;
   Classifier *o = NULL;
@@ -385,7 +460,11 @@ Classifier *apply_cmdline_args(string name,cmdline::parser& c,int num_dimensions
     exit(0);
   }
 
-  if (!p.parse(c.rest())) {
+  /* parameters set by a search replace the ones given on the command line */
+  vector<string> args = c.rest();
+  args.insert(args.end(), overrides.begin(), overrides.end());
+
+  if (!p.parse(args)) {
     cerr << c.usage() << endl << name << " options:" << endl << p.str_options() << endl << p.error() << endl;
     exit(-1);
   }
@@ -548,9 +627,7 @@ Classifier *apply_cmdline_args(string name,cmdline::parser& c,int num_dimensions
         p.get<double>("min-change"),
         p.get<double>("max-epochs"));
   } else {
-    fstream fin; fin.open(name);
-    o = loadClassifierFromFile(fin);
-    fin.close();
+    o = loadClassifierFromFile(name);
   }
 
   if (o != NULL)